@@ -9,14 +9,56 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <cstring>
 #include <iostream>
 using namespace std;
 
+// Page 0 of an index file holds the tree metadata; the nodes follow it
+static const PageId META_PID = 0;
+static const char INDEX_MAGIC[8] = "BTINDEX";
+static const char STRING_INDEX_MAGIC[8] = "BTSINDX";
+static const int INDEX_VERSION = 1;
+
+typedef struct {
+	char magic[8];  // INDEX_MAGIC
+	int version;    // INDEX_VERSION
+	PageId rootPid; // the root node, or -1 for an empty tree
+	int treeHeight; // 0 for an empty tree, 1 if the root is a leaf
+	int packedLeaves; // nonzero if the leaves are in the packed format
+	int countedNodes; // nonzero if the nonleaf nodes are counted
+	int hasStats;     // nonzero once the statistics below are kept
+	int statsBase;    // the entry count when the histogram was built
+	IndexStats stats; // the statistics on the keys
+} IndexHeader;
+
+bool BTreeIndex::packLeaves = false;
+bool BTreeIndex::countNodes = false;
+int BTreeIndex::upperCacheSize = 64;
+
 /*
  * BTreeIndex constructor
  */
 BTreeIndex::BTreeIndex()
 {
+	rootPid = -1;
+	treeHeight = 0;
+	packedLeaves = false;
+	counted = false;
+	memset(&stats, 0, sizeof(stats));
+	hasStats = true;
+	statsBase = 0;
+	dirty = false;
+	bulk = NULL;
+	bulkFill = 1;
+}
+
+/*
+ * BTreeIndex destructor
+ */
+BTreeIndex::~BTreeIndex()
+{
+	clear_upper();
+	delete bulk;
 }
 
 /*
@@ -28,110 +70,368 @@ BTreeIndex::BTreeIndex()
  */
 RC BTreeIndex::open(const string& indexname, char mode)
 {
-	if(pf.open(indexname, mode))
-		return 1;
-	char buffer[PageFile::PAGE_SIZE];
+	RC rc;
+	clear_upper();
+	if((rc = pf.open(indexname, mode)) < 0)
+		return rc;
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	IndexHeader* h = (IndexHeader*) buffer;
+  dirty = false;
   // initialize
   if (pf.endPid() == 0)
   {
-    rootPid = 0;
+    rootPid = -1;
     treeHeight = 0;
+    packedLeaves = packLeaves;
+    counted = countNodes;
+    memset(&stats, 0, sizeof(stats));
+    hasStats = true;
+    statsBase = 0;
+    // claim page 0 right away so the first node lands after it
+    if (mode == 'w' || mode == 'W')
+      return writeHeader();
     return 0;
   }
   //already initialized
-  if (pf.read(0, buffer))
-    return 1;
-  rootPid = *((PageId*) buffer + 254);
-  treeHeight = *((int*) (buffer+253));
+  if ((rc = pf.read(META_PID, buffer)) < 0) {
+    pf.close();
+    return rc;
+  }
+  // an index from before the header page cannot be read. SqlEngine
+  // rebuilds it from its table
+  if (memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      h->version != INDEX_VERSION) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+  rootPid = h->rootPid;
+  treeHeight = h->treeHeight;
+  packedLeaves = h->packedLeaves != 0;
+  counted = h->countedNodes != 0;
+  hasStats = h->hasStats != 0;
+  statsBase = h->statsBase;
+  stats = h->stats;
   return 0;
 }
 
+/*
+ * Write the root pid, tree height, node formats and key statistics to
+ * the metadata page.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeHeader()
+{
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	IndexHeader* h = (IndexHeader*) buffer;
+	memset(buffer, 0, pf.pageSize());
+	memcpy(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	h->version = INDEX_VERSION;
+	h->rootPid = rootPid;
+	h->treeHeight = treeHeight;
+	h->packedLeaves = packedLeaves;
+	h->countedNodes = counted;
+	h->hasStats = hasStats;
+	h->statsBase = statsBase;
+	h->stats = stats;
+	return pf.write(META_PID, buffer);
+}
+
 /*
  * Close the index file.
  * @return error code. 0 if no error
  */
 RC BTreeIndex::close()
 {
-    //save to file
-    char buffer[PageFile::PAGE_SIZE];
-	pf.read(0, buffer);
-	*((PageId*) buffer + 254)=rootPid;
-	*((int*) (buffer+253))=treeHeight;
-    pf.write(0,buffer);
+    endBulkLoad(); // if one was left open
 
+    //the statistics of an index inserted into may need a fresh histogram
+    if (dirty && (!hasStats || stats.buckets == 0 || stats.entryCount >= 2*statsBase))
+      rebuild_stats();
+    dirty = false;
+
+    //save to file (fails harmlessly under 'r' mode)
+    writeHeader();
+
+    clear_upper();
     return pf.close();
 }
 
-RC BTreeIndex::update_root(bool push, int key, const RecordId& rid, PageId pid){
+/*
+ * Set the # of nonleaf nodes each open index keeps in memory.
+ * @param count[IN] the # of nodes to keep (>= 0), 0 to keep none
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::setUpperCacheSize(int count)
+{
+	if (count < 0)
+		return RC_INVALID_CACHE_SIZE;
+	upperCacheSize = count;
+	return 0;
+}
+
+/*
+ * Drop the nonleaf nodes kept in memory.
+ */
+void BTreeIndex::clear_upper()
+{
+	for (map<PageId, BTNonLeafNode*>::iterator it = upper.begin(); it != upper.end(); it++)
+		delete it->second;
+	upper.clear();
+}
+
+/*
+ * Get nonleaf node pid. The node is kept in memory if there is room for
+ * it, and found there the next time. Otherwise it is pinned in spare,
+ * which must outlive the use of node.
+ * @param spare[IN] the node to pin the page in if needed
+ * @param node[OUT] the node
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::upper_node(PageId pid, BTNonLeafNode& spare, BTNonLeafNode*& node)
+{
+	RC rc;
+	map<PageId, BTNonLeafNode*>::iterator it = upper.find(pid);
+	if (it != upper.end()) {
+		node = it->second;
+		return 0;
+	}
+	
+	if ((int) upper.size() < upperCacheSize) {
+		node = new BTNonLeafNode(pf.pageSize());
+		if ((rc = node->read(pid, pf)) < 0) {
+			delete node;
+			return rc;
+		}
+		upper[pid] = node;
+		return 0;
+	}
+	
+	// No room, look at the cached frame without copying it
+	node = &spare;
+	return spare.pin(pid, pf);
+}
+
+/*
+ * Find the child of nonleaf node pid to follow for searchKey.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locate_child(PageId pid, int searchKey, PageId& child)
+{
+	RC rc;
+	BTNonLeafNode spare, *node;
+	if ((rc = upper_node(pid, spare, node)) < 0)
+		return rc;
+	return node->locateChildPtr(searchKey, child);
+}
+
+RC BTreeIndex::update_root(bool push, int key, const RecordId& rid, PageId pid, int count){
 	if(push==false){
-		BTLeafNode leaf;
+		BTLeafNode leaf(pf.pageSize());
+		leaf.setPacked(packedLeaves); // later leaves split off this one
 		leaf.insert(key, rid);
 		rootPid = pf.endPid();
 		treeHeight++;
+		stats.leafCount = 1;
 		leaf.write(rootPid, pf);
 	}else{
-		BTNonLeafNode newRoot;
+		BTNonLeafNode newRoot(pf.pageSize());
+		newRoot.setCounted(counted);
 		newRoot.initializeRoot(rootPid, key, pid);
+		newRoot.setLevel(treeHeight); // one above the old root
+		if (counted) {
+			// The old root is the left half now, count what is left in it
+			int left = 0;
+			if (treeHeight == 1) {
+				BTLeafNode leaf;
+				if (leaf.read(rootPid, pf) || count_leaf(leaf, 0, leaf.getKeyCount(), left))
+					return 1;
+			} else {
+				BTNonLeafNode node;
+				if (node.read(rootPid, pf))
+					return 1;
+				left = node.countBefore(node.getKeyCount()+1);
+			}
+			newRoot.setChildCount(0, left);
+			newRoot.setChildCount(1, count);
+		}
 		rootPid = pf.endPid();
 		newRoot.write(rootPid, pf);
 	}
 	return 0;
 }
 
-RC BTreeIndex::insert_leaf(int key, const RecordId& rid, PageId pid, int& overflowKey, PageId& overflowPid){
+/*
+ * Count the RecordIds of the entries [from, to) of leaf, reading the
+ * first page of each posting list among them. The leaf is unpinned
+ * first, so that only one page is pinned at a time.
+ * @param count[OUT] the # RecordIds
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::count_leaf(BTLeafNode& leaf, int from, int to, int& count){
+	RC rc;
+	vector<PageId> heads;
+	int key;
+	RecordId rid;
+	count = 0;
+	for (int eid = from; eid < to; eid++) {
+		if ((rc = leaf.readEntry(eid, key, rid)) < 0)
+			return rc;
+		if (rid.sid == POSTING_SID)
+			heads.push_back(rid.pid);
+		else
+			count++;
+	}
+	leaf.unpin();
+	
+	BTPostingNode first;
+	for (unsigned i = 0; i < heads.size(); i++) {
+		if ((rc = first.pin(heads[i], pf)) < 0)
+			return rc;
+		count += first.getTotalCount();
+	}
+	return 0;
+}
+
+/*
+ * Add rid at the end of the posting list starting at head.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::insert_posting(PageId head, const RecordId& rid){
+	RC rc;
+	BTPostingNode first, tail;
+	if ((rc = first.read(head, pf)) < 0)
+		return rc;
+	
+	// The first page knows the last one, so nothing else is read
+	PageId lastPid = first.getLastNodePtr();
+	BTPostingNode* last = &first;
+	if (lastPid != head) {
+		if ((rc = tail.read(lastPid, pf)) < 0)
+			return rc;
+		last = &tail;
+	}
+	
+	if (last->append(rid) == RC_NODE_FULL) {
+		BTPostingNode page(pf.pageSize());
+		page.append(rid);
+		PageId pagePid = pf.endPid();
+		if ((rc = page.write(pagePid, pf)) < 0)
+			return rc;
+		last->setNextNodePtr(pagePid);
+		first.setLastNodePtr(pagePid);
+	}
+	if (last != &first && (rc = last->write(lastPid, pf)) < 0)
+		return rc;
+	first.setTotalCount(first.getTotalCount()+1);
+	return first.write(head, pf);
+}
+
+RC BTreeIndex::insert_leaf(int key, const RecordId& rid, PageId pid, int& overflowKey, PageId& overflowPid, int& overflowCount){
 	BTLeafNode leafNode;
+	RecordId entry = rid; // what goes into the leaf for key
     leafNode.read(pid, pf);
-    if (leafNode.insert(key, rid)) //overflow
+    
+    // A duplicate key goes behind its run in the leaf, until the run
+    // outgrows the leaf and moves to a posting list
+    int eid, found;
+    RecordId old;
+    if (leafNode.locate(key, eid) == 0 && leafNode.readEntry(eid, found, old) == 0 && found == key) {
+      if (old.sid == POSTING_SID)
+        return insert_posting(old.pid, rid);
+      vector<RecordId> run(1, old);
+      while (leafNode.readEntry(eid+run.size(), found, old) == 0 && found == key)
+        run.push_back(old);
+      if ((int) run.size() >= leafNode.getMaxRunLength()) {
+        run.push_back(rid);
+        entry.sid = POSTING_SID;
+        if (bulk_posting(run, entry.pid))
+          return 1;
+        // the reference is inserted in place of the run below
+        for (unsigned i = 1; i < run.size(); i++)
+          leafNode.removeEntry(eid);
+      }
+    }
+    
+    if (leafNode.insert(key, entry)) //overflow
     {
-      BTLeafNode leafNode2;
-      if (leafNode.insertAndSplit(key, rid, leafNode2, overflowKey))
+      BTLeafNode leafNode2(pf.pageSize());
+      if (leafNode.insertAndSplit(key, entry, leafNode2, overflowKey))
         return 1;
 
       overflowPid = pf.endPid();
-	  leafNode2.setNextNodePtr(leafNode.getNextNodePtr());
+      stats.leafCount++;
+	  PageId next = leafNode.getNextNodePtr();
+	  leafNode2.setNextNodePtr(next);
+	  leafNode2.setPrevNodePtr(pid);
       leafNode.setNextNodePtr(overflowPid);
 	  
       if (leafNode2.write(overflowPid, pf))
         return 1;
+      if (counted && count_leaf(leafNode2, 0, leafNode2.getKeyCount(), overflowCount))
+        return 1;
+	  
+	  // The old right neighbor now has the new leaf on its left
+	  if (next != RC_END_OF_TREE) {
+		BTLeafNode nextNode;
+		if (nextNode.read(next, pf) || nextNode.setPrevNodePtr(overflowPid) || nextNode.write(next, pf))
+		  return 1;
+	  }
     }
     if (leafNode.write(pid, pf))
       return 1;
 	return 0;
 }
 
-RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int level, int& overflowKey, PageId& overflowPid){
-  overflowKey = 0;
+RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int level, int& overflowKey, PageId& overflowPid, int& overflowCount){
+  overflowPid = -1; // no split unless a child overflows
+  overflowCount = 0;
 
   if (level == treeHeight){
-    insert_leaf(key, rid, pid, overflowKey, overflowPid);
+    insert_leaf(key, rid, pid, overflowKey, overflowPid, overflowCount);
   }else{
     BTNonLeafNode nonLeaf;
     PageId child;
+    int eid;
     nonLeaf.read(pid, pf);
-    nonLeaf.locateChildPtr(key, child);
-    insert_recursive(key, rid, child, level+1, overflowKey, overflowPid); //WE MUST GO DEEPER
-	//BEGINNING TO SURFACE, must fix the overflow at this level
-    if (overflowKey > 0) //overflow not fixed
+    nonLeaf.locateChildPtr(key, child, eid);
+    insert_recursive(key, rid, child, level+1, overflowKey, overflowPid, overflowCount); //WE MUST GO DEEPER
+	//BEGINNING TO SURFACE, a counted node gains the new RecordId,
+	//less what moved to a new sibling of the child
+    bool changed = counted;
+    if (counted)
+      nonLeaf.setChildCount(eid, nonLeaf.getChildCount(eid)+1-overflowCount);
+	//must fix the overflow at this level
+    if (overflowPid >= 0) //overflow not fixed
     {
-      if (nonLeaf.insert(overflowKey, overflowPid)) //overflow
+      changed = true;
+      if (nonLeaf.insert(overflowKey, overflowPid, overflowCount)) //overflow
       {
         int midKey;
-        BTNonLeafNode sibling;
+        BTNonLeafNode sibling(pf.pageSize());
 
-        nonLeaf.insertAndSplit(overflowKey, overflowPid, sibling, midKey);
+        nonLeaf.insertAndSplit(overflowKey, overflowPid, sibling, midKey, overflowCount);
         overflowKey = midKey;
         overflowPid = pf.endPid();
+        overflowCount = sibling.countBefore(sibling.getKeyCount()+1);
         if (sibling.write(overflowPid, pf))
           return 1;
       }
       else
       {
-        overflowKey = 0;
+        overflowPid = -1;
+        overflowCount = 0;
       }
+    }
+    if (changed)
+    {
       nonLeaf.write(pid, pf);
+      if (upper.count(pid)) { //the copy in memory is stale now
+        delete upper[pid];
+        upper.erase(pid);
+      }
     }
   }
-  return (overflowKey ? 1 : 0);
+  return (overflowPid >= 0 ? 1 : 0);
 }
 
 /*
@@ -142,18 +442,21 @@ RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int le
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
+	dirty = true;
+	update_stats(key);
 	if (treeHeight == 0) //new tree?
 	{
-		PageId dummy;
-		update_root(false,key,rid,dummy);
+		PageId dummy = -1;
+		update_root(false,key,rid,dummy,0);
 	}else{
-		int overflowKey=0;
+		int overflowKey;
 		PageId overflowPid;
+		int overflowCount;
 		
-		insert_recursive(key, rid, rootPid, 1, overflowKey, overflowPid);
+		insert_recursive(key, rid, rootPid, 1, overflowKey, overflowPid, overflowCount);
 
-		if (overflowKey > 0){ //create new root???
-			update_root(true,overflowKey,rid,overflowPid); 
+		if (overflowPid >= 0){ //create new root???
+			update_root(true,overflowKey,rid,overflowPid,overflowCount); 
 			treeHeight++;
 		}
 	}
@@ -182,23 +485,30 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
     PageId pid = rootPid; // Start at top of the tree
-	BTNonLeafNode nontemp;
-	int eid;
+	RC rc;
+	
+	// Nothing to find in an empty tree
+	if (treeHeight == 0) {
+		cursor.pid = RC_END_OF_TREE;
+		cursor.eid = 0;
+		cursor.postingPid = -1;
+		return 0;
+	}
 	
 	// Traverse the tree until you reach the leaf height
 	for(int i = 1; i < treeHeight; i++) {
-		if(nontemp.read(pid, pf)) // Read in the appropriate page
-			return 1;
-		nontemp.locateChildPtr(searchKey, pid); // Update pid
+		if((rc = locate_child(pid, searchKey, pid)) < 0) // Update pid
+			return rc;
 	}
 	
 	// At this point, pid is pointing to the correct leaf page
 	BTLeafNode leaftemp;
-	if(leaftemp.read(pid, pf))
+	if(leaftemp.pin(pid, pf))
 		return 1;
 	
 	leaftemp.locate(searchKey, cursor.eid); // Update eid
 	cursor.pid = pid; // Update pid
+	cursor.postingPid = -1;
 	return 0;
 }
 
@@ -212,23 +522,1209 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
-	if (cursor.pid < 0 || cursor.pid >= pf.endPid()) // Check for valid pid
-		return 1;
-		
 	BTLeafNode temp;	// Initialize temporary leaf node
-	temp.read(cursor.pid, pf);	// Read the page into the temporary buffer
+	BTPostingNode posting;
+	RC rc;
 	
-	// Check if eid goes past current node's contents
-	if((cursor.eid) == temp.getKeyCount()) {
-		cursor.eid = 0; // Set to beginning of next file
-		cursor.pid = temp.getNextNodePtr(); // Set pointer to the next page
-		if(cursor.pid==RC_END_OF_TREE)
+	while (true) {
+		// Inside a posting list: its next RecordId, or on past the list
+		if (cursor.postingPid >= 0) {
+			temp.unpin(); // one pinned page at a time
+			if ((rc = posting.pin(cursor.postingPid, pf)) < 0)
+				return rc;
+			if (posting.readEntry(cursor.postingEid, rid) == 0) {
+				cursor.postingEid++;
+				key = cursor.postingKey;
+				return 0;
+			}
+			cursor.postingPid = posting.getNextNodePtr();
+			cursor.postingEid = 0;
+			if (cursor.postingPid < 0) {
+				cursor.postingPid = -1;
+				cursor.eid++;
+			}
+			continue;
+		}
+		
+		// Move past the end of the node (and any empty node) to the next entry
+		if (cursor.pid == RC_END_OF_TREE)
 			return RC_END_OF_TREE;
-		else
-			return 1;
-	}else{
+		if (cursor.pid <= META_PID || cursor.pid >= pf.endPid()) // Check for valid pid
+			return RC_INVALID_CURSOR;
+		posting.unpin();
+		if((rc = temp.pin(cursor.pid, pf)) < 0)	// Pin the page, the node uses the cached frame
+			return rc;
+		if (cursor.eid >= temp.getKeyCount()) {
+			cursor.eid = 0; // Set to beginning of next node
+			cursor.pid = temp.getNextNodePtr(); // Set pointer to the next page
+			continue;
+		}
+		
 		temp.readEntry(cursor.eid,key,rid); // Read the entry
+		if (rid.sid == POSTING_SID) {
+			// A duplicate key, read its RecordIds from the list
+			cursor.postingPid = rid.pid;
+			cursor.postingEid = 0;
+			cursor.postingKey = key;
+			continue;
+		}
 		cursor.eid++;
+		return 0;
+	}
+}
+
+/*
+ * Find the last leaf-node index entry whose key value is smaller than or
+ * equal to searchKey and output a cursor that readBackward() returns it from.
+ * @param searchKey[IN] the largest key to return
+ * @param cursor[OUT] the cursor just past the entry; it may sit at the
+ *                    start of a node, and readBackward() moves on to the
+ *                    previous node from there.
+ * @return error code. 0 if no error.
+ */
+RC BTreeIndex::locateBackward(int searchKey, IndexCursor& cursor)
+{
+	RC rc;
+	if (searchKey < INT_MAX)
+		return locate(searchKey+1, cursor);
+	
+	// Nothing is larger, so start past the end of the last leaf.
+	// A separator equal to INT_MAX leaves locate() one leaf short of it.
+	if ((rc = locate(searchKey, cursor)) < 0 || cursor.pid == RC_END_OF_TREE)
+		return rc;
+	BTLeafNode leaf;
+	while (true) {
+		if ((rc = leaf.pin(cursor.pid, pf)) < 0)
+			return rc;
+		if (leaf.getNextNodePtr() == RC_END_OF_TREE)
+			break;
+		cursor.pid = leaf.getNextNodePtr();
+	}
+	cursor.eid = leaf.getKeyCount();
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pair just before the location specified by the
+ * index cursor, and move the cursor back to it. The RecordIds in the
+ * posting list of a duplicate key still come in list order, while a
+ * run of them kept in the leaf comes back last one first.
+ * @param cursor[IN/OUT] the cursor just past a leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored before the index cursor location.
+ * @param rid[OUT] the RecordId stored before the index cursor location.
+ * @return error code. 0 if no error, RC_END_OF_TREE before the first entry
+ */
+RC BTreeIndex::readBackward(IndexCursor& cursor, int& key, RecordId& rid)
+{
+	BTLeafNode temp;
+	BTPostingNode posting;
+	RC rc;
+	
+	while (true) {
+		// Inside a posting list: its next RecordId, or on before the key
+		if (cursor.postingPid >= 0) {
+			temp.unpin(); // one pinned page at a time
+			if ((rc = posting.pin(cursor.postingPid, pf)) < 0)
+				return rc;
+			if (posting.readEntry(cursor.postingEid, rid) == 0) {
+				cursor.postingEid++;
+				key = cursor.postingKey;
+				return 0;
+			}
+			cursor.postingPid = posting.getNextNodePtr();
+			cursor.postingEid = 0;
+			if (cursor.postingPid < 0) {
+				cursor.postingPid = -1;
+				cursor.eid--;
+			}
+			continue;
+		}
+		
+		// Move before the start of the node (and any empty node) to the previous entry
+		if (cursor.pid == RC_END_OF_TREE)
+			return RC_END_OF_TREE;
+		if (cursor.pid <= META_PID || cursor.pid >= pf.endPid())
+			return RC_INVALID_CURSOR;
+		posting.unpin();
+		if ((rc = temp.pin(cursor.pid, pf)) < 0)
+			return rc;
+		if (cursor.eid > temp.getKeyCount())
+			cursor.eid = temp.getKeyCount(); // entering from the node on the right
+		if (cursor.eid <= 0) {
+			cursor.eid = INT_MAX; // the end of the previous node, whatever its size
+			cursor.pid = temp.getPrevNodePtr();
+			continue;
+		}
+		
+		temp.readEntry(cursor.eid-1, key, rid);
+		if (rid.sid == POSTING_SID) {
+			cursor.postingPid = rid.pid;
+			cursor.postingEid = 0;
+			cursor.postingKey = key;
+			continue;
+		}
+		cursor.eid--;
+		return 0;
+	}
+}
+
+/*
+ * Count the RecordIds with a key in [startKey, endKey].
+ * @param count[OUT] the # RecordIds
+ * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+ *         nonleaf nodes are not counted
+ */
+RC BTreeIndex::countRange(int startKey, int endKey, int& count)
+{
+	RC rc;
+	int below, upTo;
+	count = 0;
+	if (!counted)
+		return RC_INVALID_FILE_FORMAT;
+	if (startKey > endKey)
+		return 0;
+	if ((rc = count_below(startKey, below)) < 0)
+		return rc;
+	if (endKey < INT_MAX)
+		rc = count_below(endKey+1, upTo);
+	else
+		rc = count_all(upTo);
+	if (rc < 0)
+		return rc;
+	count = upTo-below;
+	return 0;
+}
+
+/*
+ * Count the RecordIds in the tree.
+ * @param count[OUT] the # RecordIds
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::count_all(int& count){
+	RC rc;
+	count = 0;
+	if (treeHeight == 0)
+		return 0;
+	if (treeHeight == 1) {
+		BTLeafNode leaf;
+		if ((rc = leaf.pin(rootPid, pf)) < 0)
+			return rc;
+		return count_leaf(leaf, 0, leaf.getKeyCount(), count);
+	}
+	BTNonLeafNode spare, *node;
+	if ((rc = upper_node(rootPid, spare, node)) < 0)
+		return rc;
+	count = node->countBefore(node->getKeyCount()+1);
+	return 0;
+}
+
+/*
+ * Count the RecordIds with a key smaller than searchKey on the way down
+ * to the leaf where locate() finds searchKey: the counts of the children
+ * to the left of the path, then the entries before it in the leaf.
+ * @param count[OUT] the # RecordIds
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::count_below(int searchKey, int& count){
+	RC rc;
+	PageId pid = rootPid;
+	int leafTotal = -1; // the count of the leaf, once known from its parent
+	count = 0;
+	if (treeHeight == 0)
+		return 0;
+	for (int i = 1; i < treeHeight; i++) {
+		BTNonLeafNode spare, *node;
+		int eid;
+		if ((rc = upper_node(pid, spare, node)) < 0)
+			return rc;
+		node->locateChildPtr(searchKey, pid, eid);
+		count += node->countBefore(eid);
+		leafTotal = node->getChildCount(eid);
+	}
+	
+	// Count whichever side of the entry is shorter
+	BTLeafNode leaf;
+	int eid, part;
+	if ((rc = leaf.pin(pid, pf)) < 0)
+		return rc;
+	leaf.locate(searchKey, eid);
+	int keyCount = leaf.getKeyCount();
+	if (leafTotal < 0 || eid <= keyCount/2) {
+		rc = count_leaf(leaf, 0, eid, part);
+		count += part;
+	} else {
+		rc = count_leaf(leaf, eid, keyCount, part);
+		count += leafTotal-part;
+	}
+	return rc;
+}
+
+/*
+ * Get the statistics of the index.
+ * @param stats[OUT] the statistics
+ * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+ *         index has none yet
+ */
+RC BTreeIndex::getStats(IndexStats& stats)
+{
+	if (!hasStats)
+		return RC_INVALID_FILE_FORMAT;
+	stats = this->stats;
+	return 0;
+}
+
+/*
+ * Estimate the # RecordIds with a key in [startKey, endKey], taking the
+ * part of each bucket the range covers as its share of the bucket.
+ * @param count[OUT] the estimated # RecordIds
+ * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+ *         index has no statistics yet
+ */
+RC BTreeIndex::estimateRange(int startKey, int endKey, int& count)
+{
+	count = 0;
+	if (!hasStats)
+		return RC_INVALID_FILE_FORMAT;
+	double total = 0;
+	for (int b = 0; b < stats.buckets; b++) {
+		double high = stats.bound[b];
+		double low = min(high, (b == 0) ? (double) stats.minKey : stats.bound[b-1]+1.0);
+		double from = max(low, (double) startKey);
+		double to = min(high, (double) endKey);
+		if (from <= to)
+			total += stats.count[b]*(to-from+1)/(high-low+1);
+	}
+	count = (int) (total+0.5);
+	return 0;
+}
+
+/*
+ * Count a new RecordId with key in the statistics. A key past the last
+ * bucket stretches that bucket.
+ */
+void BTreeIndex::update_stats(int key){
+	if (!hasStats)
+		return; // close() builds them from the leaves
+	if (stats.entryCount == 0 || key < stats.minKey)
+		stats.minKey = key;
+	if (stats.entryCount == 0 || key > stats.maxKey)
+		stats.maxKey = key;
+	stats.entryCount++;
+	
+	int b = lower_bound(stats.bound, stats.bound+stats.buckets, key)-stats.bound;
+	if (b == stats.buckets) {
+		if (b == 0)
+			stats.buckets = 1;
+		else
+			b--;
+		stats.bound[b] = key;
+	}
+	stats.count[b]++;
+}
+
+/*
+ * Build the statistics from the leaves, given in key order.
+ * A bucket of the histogram ends with the leaf that fills its share.
+ * @param minKey[IN] the smallest key
+ * @param maxKeys[IN] the largest key of each leaf
+ * @param counts[IN] the # RecordIds in each leaf
+ */
+void BTreeIndex::build_stats(int minKey, const vector<int>& maxKeys, const vector<int>& counts){
+	memset(&stats, 0, sizeof(stats));
+	stats.leafCount = maxKeys.size();
+	for (unsigned i = 0; i < counts.size(); i++)
+		stats.entryCount += counts[i];
+	if (!maxKeys.empty()) {
+		stats.minKey = minKey;
+		stats.maxKey = maxKeys.back();
+	}
+	
+	int share = (stats.entryCount+HISTOGRAM_BUCKETS-1)/HISTOGRAM_BUCKETS;
+	int b = 0;
+	for (unsigned i = 0; i < maxKeys.size(); i++) {
+		stats.count[b] += counts[i];
+		stats.bound[b] = maxKeys[i];
+		if (stats.count[b] >= share && b < HISTOGRAM_BUCKETS-1)
+			b++;
+	}
+	stats.buckets = (stats.count[b] > 0) ? b+1 : b;
+	hasStats = true;
+	statsBase = stats.entryCount;
+}
+
+/*
+ * Rebuild the statistics with a pass over the leaves.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::rebuild_stats(){
+	RC rc;
+	IndexCursor cursor;
+	vector<int> maxKeys, counts;
+	int minKey = 0, key, count;
+	RecordId rid;
+	
+	if ((rc = locate(INT_MIN, cursor)) < 0)
+		return rc;
+	BTLeafNode leaf;
+	PageId pid = cursor.pid;
+	while (pid != RC_END_OF_TREE) {
+		if ((rc = leaf.pin(pid, pf)) < 0)
+			return rc;
+		pid = leaf.getNextNodePtr();
+		int keyCount = leaf.getKeyCount();
+		if (keyCount == 0)
+			continue;
+		if (maxKeys.empty())
+			leaf.readEntry(0, minKey, rid);
+		leaf.readEntry(keyCount-1, key, rid);
+		if ((rc = count_leaf(leaf, 0, keyCount, count)) < 0)
+			return rc;
+		maxKeys.push_back(key);
+		counts.push_back(count);
+	}
+	build_stats(minKey, maxKeys, counts);
+	return 0;
+}
+
+/*
+ * Find the RecordIds of many keys at once.
+ * @param keys[IN] the keys to find, in any order
+ * @param rids[OUT] rids[i] gets the RecordIds of keys[i]
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locateBatch(const vector<int>& keys, vector<vector<RecordId> >& rids)
+{
+	rids.assign(keys.size(), vector<RecordId>());
+	if (treeHeight == 0 || keys.empty())
+		return 0;
+	
+	// Sort the keys, remembering where each one came from
+	Probes probes(keys.size());
+	for (unsigned i = 0; i < keys.size(); i++)
+		probes[i] = make_pair(keys[i], (int) i);
+	sort(probes.begin(), probes.end());
+	return locate_batch(rootPid, 1, probes, 0, probes.size(), rids);
+}
+
+/*
+ * Find the keys of probes [from, to), which all lead to node pid.
+ * A nonleaf hands each run of keys going to the same child to that
+ * child. No page stays pinned while the children are visited.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locate_batch(PageId pid, int level, const Probes& probes, int from, int to,
+                            vector<vector<RecordId> >& rids)
+{
+	RC rc;
+	if (level < treeHeight) {
+		vector<PageId> child(to-from);
+		{
+			BTNonLeafNode spare, *node;
+			if ((rc = upper_node(pid, spare, node)) < 0)
+				return rc;
+			for (int i = from; i < to; i++)
+				node->locateChildPtr(probes[i].first, child[i-from]);
+		}
+		for (int i = from; i < to; ) {
+			int end = i+1;
+			while (end < to && child[end-from] == child[i-from])
+				end++;
+			if ((rc = locate_batch(child[i-from], level+1, probes, i, end, rids)) < 0)
+				return rc;
+			i = end;
+		}
+		return 0;
+	}
+	
+	// At the leaf, which holds every key that leads to it
+	vector<pair<int, RecordId> > found; // (probe, leaf entry) pairs
+	{
+		BTLeafNode leaf;
+		if ((rc = leaf.pin(pid, pf)) < 0)
+			return rc;
+		for (int i = from; i < to; i++) {
+			int eid, key;
+			RecordId rid;
+			if (leaf.locate(probes[i].first, eid) != 0)
+				continue;
+			// the whole run of the key
+			while (leaf.readEntry(eid++, key, rid) == 0 && key == probes[i].first)
+				found.push_back(make_pair(i, rid));
+		}
+	}
+	
+	// Read the lists of the duplicate keys, one pinned page at a time
+	for (unsigned i = 0; i < found.size(); i++) {
+		vector<RecordId>& out = rids[probes[found[i].first].second];
+		if (found[i].second.sid != POSTING_SID)
+			out.push_back(found[i].second);
+		else if ((rc = read_posting(found[i].second.pid, out)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Append the RecordIds of the posting list starting at head to rids.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::read_posting(PageId head, vector<RecordId>& rids){
+	RC rc;
+	BTPostingNode page;
+	for (PageId pid = head; pid >= 0; pid = page.getNextNodePtr()) {
+		if ((rc = page.pin(pid, pf)) < 0)
+			return rc;
+		int n = page.getCount();
+		for (int i = 0; i < n; i++) {
+			RecordId rid;
+			page.readEntry(i, rid);
+			rids.push_back(rid);
+		}
+	}
+	return 0;
+}
+
+/*
+ * BTreeScan constructor
+ */
+BTreeScan::BTreeScan()
+{
+	index = NULL;
+	batchCount = batchPos = 0;
+}
+
+/*
+ * Start scanning index at the first entry with a key >= startKey.
+ * @return error code. 0 if no error
+ */
+RC BTreeScan::open(BTreeIndex& index, int startKey, int endKey)
+{
+	RC rc;
+	this->index = &index;
+	this->endKey = endKey;
+	batchCount = batchPos = 0;
+	if ((rc = index.locate(startKey, cursor)) < 0) {
+		this->index = NULL;
+		return rc;
+	}
+	return 0;
+}
+
+/*
+ * Read the next (key, rid) pair of the scan.
+ * @return error code. 0 if no error, RC_END_OF_TREE past the last entry
+ */
+RC BTreeScan::next(int& key, RecordId& rid)
+{
+	RC rc;
+	if (batchPos == batchCount) {
+		batchPos = 0;
+		if ((rc = fill(batchKey, batchRid, BATCH_SIZE, batchCount)) < 0)
+			return rc;
+		if (batchCount == 0)
+			return RC_END_OF_TREE;
+	}
+	key = batchKey[batchPos];
+	rid = batchRid[batchPos];
+	batchPos++;
+	return 0;
+}
+
+/*
+ * Read the next (key, rid) pairs of the scan, up to max of them.
+ * @return error code. 0 if no error
+ */
+RC BTreeScan::nextBatch(int key[], RecordId rid[], int max, int& count)
+{
+	// Hand out what next() already copied first
+	for (count = 0; count < max && batchPos < batchCount; count++, batchPos++) {
+		key[count] = batchKey[batchPos];
+		rid[count] = batchRid[batchPos];
+	}
+	if (count == max)
+		return 0;
+	
+	int more;
+	RC rc = fill(key+count, rid+count, max-count, more);
+	count += more;
+	return rc;
+}
+
+/*
+ * End the scan.
+ * @return error code. 0 if no error
+ */
+RC BTreeScan::close()
+{
+	index = NULL;
+	batchCount = batchPos = 0;
+	return 0;
+}
+
+/*
+ * Copy up to max entries from the cursor on, following the sibling
+ * pointers and posting lists. The pages are pinned only during the call.
+ * @return error code. 0 if no error
+ */
+RC BTreeScan::fill(int key[], RecordId rid[], int max, int& count)
+{
+	RC rc;
+	BTLeafNode leaf;
+	BTPostingNode posting;
+	
+	count = 0;
+	if (index == NULL)
+		return RC_INVALID_CURSOR;
+	PageFile& pf = index->pf;
+	while (count < max) {
+		// Inside a posting list: its RecordIds, then on past the list.
+		// One page is pinned at a time, so a pool of one frame will do.
+		if (cursor.postingPid >= 0) {
+			leaf.unpin();
+			if ((rc = posting.pin(cursor.postingPid, pf)) < 0)
+				return rc;
+			int n = posting.getCount();
+			for (; count < max && cursor.postingEid < n; count++, cursor.postingEid++) {
+				posting.readEntry(cursor.postingEid, rid[count]);
+				key[count] = cursor.postingKey;
+			}
+			if (cursor.postingEid == n) {
+				cursor.postingPid = posting.getNextNodePtr();
+				cursor.postingEid = 0;
+				if (cursor.postingPid < 0) {
+					cursor.postingPid = -1;
+					cursor.eid++;
+				}
+			}
+			continue;
+		}
+		
+		if (cursor.pid == RC_END_OF_TREE)
+			break;
+		if (cursor.pid <= META_PID || cursor.pid >= pf.endPid())
+			return RC_INVALID_CURSOR;
+		posting.unpin();
+		if ((rc = leaf.pin(cursor.pid, pf)) < 0)
+			return rc;
+		int n = leaf.getKeyCount();
+		for (; count < max && cursor.eid < n; count++, cursor.eid++) {
+			leaf.readEntry(cursor.eid, key[count], rid[count]);
+			if (key[count] > endKey) {
+				// Past the range, nothing more to return
+				cursor.pid = RC_END_OF_TREE;
+				return 0;
+			}
+			if (rid[count].sid == POSTING_SID) {
+				cursor.postingPid = rid[count].pid;
+				cursor.postingEid = 0;
+				cursor.postingKey = key[count];
+				break;
+			}
+		}
+		if (cursor.eid == n) {
+			cursor.pid = leaf.getNextNodePtr();
+			cursor.eid = 0;
+		}
+	}
+	return 0;
+}
+
+bool operator< (const KeyEntry& e1, const KeyEntry& e2)
+{
+	if (e1.key != e2.key)
+		return e1.key < e2.key;
+	return e1.rid < e2.rid;
+}
+
+/*
+ * Start a bulk load.
+ * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::beginBulkLoad(double fillFactor)
+{
+	if (!(fillFactor > 0 && fillFactor <= 1))
+		return RC_INVALID_FILL_FACTOR;
+	delete bulk;
+	bulk = new ExternalSort<KeyEntry>();
+	bulkFill = fillFactor;
+	return 0;
+}
+
+/*
+ * Add (key, RecordId) pair to the bulk load.
+ * Without a bulk load the pair is inserted right away.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkInsert(int key, const RecordId& rid)
+{
+	if (bulk == NULL)
+		return insert(key, rid);
+	KeyEntry e;
+	e.key = key;
+	e.rid = rid;
+	return bulk->add(e);
+}
+
+/*
+ * Finish the bulk load, writing the pairs to the index.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::endBulkLoad()
+{
+	RC rc;
+	if (bulk == NULL)
+		return 0;
+	
+	if ((rc = bulk->finish()) == 0) {
+		if (treeHeight == 0) {
+			rc = bulk_build();
+		} else {
+			// Only an empty tree is built bottom-up, insert into this one
+			KeyEntry e;
+			while ((rc = bulk->next(e)) == 0)
+				if ((rc = insert(e.key, e.rid)) < 0)
+					break;
+			if (rc > 0)
+				rc = 0;
+		}
+	}
+	delete bulk;
+	bulk = NULL;
+	if (rc < 0)
+		return rc;
+	return writeHeader();
+}
+
+/*
+ * Write the posting list of rids on new pages, one after another.
+ * @param head[OUT] the first page of the list
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulk_posting(const vector<RecordId>& rids, PageId& head){
+	RC rc;
+	BTPostingNode page(pf.pageSize());
+	int perPage = page.getMaxCount();
+	int pages = (rids.size()+perPage-1)/perPage;
+	
+	head = pf.endPid();
+	for (int i = 0; i < pages; i++) {
+		page.initBuffer();
+		for (int j = i*perPage; j < (int) rids.size() && j < (i+1)*perPage; j++)
+			page.append(rids[j]);
+		if (i+1 < pages)
+			page.setNextNodePtr(head+i+1);
+		if (i == 0) {
+			page.setLastNodePtr(head+pages-1);
+			page.setTotalCount(rids.size());
+		}
+		if ((rc = page.write(head+i, pf)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Build the tree bottom-up from the sorted pairs of the bulk load.
+ * The leaves are written left to right. Each one is reserved as soon as
+ * the one before it is filled, so that the one before can point to it.
+ * Every level above is built from the pid and the largest key of each
+ * node of the level below, the largest key serving as the separator.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulk_build()
+{
+	RC rc;
+	vector<PageId> pids; // the nodes of the level just built
+	vector<int> maxKeys; // the largest key under each of them
+	vector<int> counts;  // the # RecordIds under each of them
+	vector<RecordId> rids;
+	int minKey = 0;
+	
+	BTLeafNode leaf(pf.pageSize()), reserved(pf.pageSize());
+	leaf.setPacked(packedLeaves);
+	int leafFill = max(1, (int) (bulkFill*leaf.getMaxKeyCount()));
+	
+	KeyEntry e;
+	bool more = (rc = bulk->next(e)) == 0;
+	while (more) {
+		// Collect the RecordIds of the next key
+		int key = e.key;
+		rids.clear();
+		while (more && e.key == key) {
+			rids.push_back(e.rid);
+			more = (rc = bulk->next(e)) == 0;
+		}
+		if (rc < 0)
+			return rc;
+		// A short run of them goes in the leaf, a longer one to a list
+		vector<RecordId> entries(rids);
+		if ((int) rids.size() > leaf.getMaxRunLength()) {
+			entries.assign(1, rids[0]);
+			entries[0].sid = POSTING_SID;
+			if ((rc = bulk_posting(rids, entries[0].pid)) < 0)
+				return rc;
+		}
+		
+		// The run goes whole into this leaf or the next one
+		bool fits = !pids.empty() && leaf.getKeyCount()+(int) entries.size() <= leafFill;
+		for (unsigned i = 0; fits && i < entries.size(); i++) {
+			if (leaf.insert(key, entries[i]) == 0)
+				continue;
+			for (; i > 0; i--)
+				leaf.removeEntry(leaf.getKeyCount()-1);
+			fits = false;
+		}
+		if (fits) {
+			maxKeys.back() = key;
+			counts.back() += rids.size();
+			continue;
+		}
+		
+		// This leaf is filled, start the next one
+		PageId pid = pf.endPid();
+		if ((rc = reserved.write(pid, pf)) < 0)
+			return rc;
+		if (!pids.empty()) {
+			leaf.setNextNodePtr(pid);
+			if ((rc = leaf.write(pids.back(), pf)) < 0)
+				return rc;
+		}
+		if (pids.empty())
+			minKey = key;
+		leaf.initBuffer();
+		leaf.setPacked(packedLeaves);
+		if (!pids.empty())
+			leaf.setPrevNodePtr(pids.back());
+		for (unsigned i = 0; i < entries.size(); i++)
+			leaf.insert(key, entries[i]);
+		pids.push_back(pid);
+		maxKeys.push_back(key);
+		counts.push_back(rids.size());
+	}
+	if (rc < 0)
+		return rc;
+	if (pids.empty())
+		return 0;
+	if ((rc = leaf.write(pids.back(), pf)) < 0)
+		return rc;
+	build_stats(minKey, maxKeys, counts);
+	
+	// A node above takes fanout nodes below. The nodes are split evenly
+	// over each level, so every one of them has at least two children.
+	BTNonLeafNode node(pf.pageSize());
+	node.setCounted(counted);
+	int fanout = max(4, (int) (bulkFill*(node.getMaxKeyCount()+1)));
+	int height = 1;
+	while (pids.size() > 1) {
+		vector<PageId> upPids;
+		vector<int> upKeys;
+		vector<int> upCounts;
+		int groups = (pids.size()+fanout-1)/fanout;
+		int first = 0;
+		for (int g = 0; g < groups; g++) {
+			int size = pids.size()/groups + (g < (int) (pids.size()%groups) ? 1 : 0);
+			node.initBuffer();
+			node.setCounted(counted);
+			node.initializeRoot(pids[first], maxKeys[first], pids[first+1]);
+			node.setChildCount(0, counts[first]);
+			node.setChildCount(1, counts[first+1]);
+			for (int i = first+2; i < first+size; i++)
+				node.insert(maxKeys[i-1], pids[i], counts[i]);
+			node.setLevel(height);
+			
+			PageId pid = pf.endPid();
+			if ((rc = node.write(pid, pf)) < 0)
+				return rc;
+			upPids.push_back(pid);
+			upKeys.push_back(maxKeys[first+size-1]);
+			upCounts.push_back(node.countBefore(size));
+			first += size;
+		}
+		pids.swap(upPids);
+		maxKeys.swap(upKeys);
+		counts.swap(upCounts);
+		height++;
+	}
+	rootPid = pids[0];
+	treeHeight = height;
+	return 0;
+}
+
+/*
+ * BTreeStringIndex constructor
+ */
+BTreeStringIndex::BTreeStringIndex()
+{
+	rootPid = -1;
+	treeHeight = 0;
+	bulk = NULL;
+	bulkFill = 1;
+}
+
+/*
+ * Open the index file in read or write mode.
+ * Under 'w' mode, the index file should be created if it does not exist.
+ * @param indexname[IN] the name of the index file
+ * @param mode[IN] 'r' for read, 'w' for write
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::open(const string& indexname, char mode)
+{
+	RC rc;
+	if ((rc = pf.open(indexname, mode)) < 0)
+		return rc;
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	IndexHeader* h = (IndexHeader*) buffer;
+	if (pf.endPid() == 0) {
+		rootPid = -1;
+		treeHeight = 0;
+		if (mode == 'w' || mode == 'W')
+			return writeHeader();
+		return 0;
+	}
+	if ((rc = pf.read(META_PID, buffer)) < 0) {
+		pf.close();
+		return rc;
+	}
+	if (memcmp(h->magic, STRING_INDEX_MAGIC, sizeof(STRING_INDEX_MAGIC)) != 0 ||
+	    h->version != INDEX_VERSION) {
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
+	rootPid = h->rootPid;
+	treeHeight = h->treeHeight;
+	return 0;
+}
+
+/*
+ * Write the root pid, tree height, node formats and key statistics to
+ * the metadata page.
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::writeHeader()
+{
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	IndexHeader* h = (IndexHeader*) buffer;
+	memset(buffer, 0, pf.pageSize());
+	memcpy(h->magic, STRING_INDEX_MAGIC, sizeof(STRING_INDEX_MAGIC));
+	h->version = INDEX_VERSION;
+	h->rootPid = rootPid;
+	h->treeHeight = treeHeight;
+	return pf.write(META_PID, buffer);
+}
+
+/*
+ * Close the index file.
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::close()
+{
+	endBulkLoad(); // if one was left open
+	
+	//save to file (fails harmlessly under 'r' mode)
+	writeHeader();
+	return pf.close();
+}
+
+RC BTreeStringIndex::insert_recursive(const string& key, const RecordId& rid, PageId pid, int level,
+                                      string& overflowKey, RecordId& overflowRid, PageId& overflowPid)
+{
+	RC rc;
+	overflowPid = -1; // no split unless this node overflows
+	
+	BTStringNode node;
+	if ((rc = node.read(pid, pf)) < 0)
+		return rc;
+	
+	PageId childPid = -1;
+	if (level < treeHeight) {
+		node.locateChildPtr(key, rid, childPid);
+		if ((rc = insert_recursive(key, rid, childPid, level+1, overflowKey, overflowRid, overflowPid)) < 0)
+			return rc;
+		if (overflowPid < 0)
+			return 0;
+		// The child split, add its sibling here
+		childPid = overflowPid;
+		overflowPid = -1;
+		if (node.insert(overflowKey, overflowRid, childPid) == 0)
+			return node.write(pid, pf);
+	} else if (node.insert(key, rid) == 0) {
+		return node.write(pid, pf);
+	}
+	
+	// This node is full too, split it
+	BTStringNode sibling(STRING_LEAF_NODE, pf.pageSize());
+	string midKey;
+	RecordId midRid;
+	if (level < treeHeight)
+		rc = node.insertAndSplit(overflowKey, overflowRid, childPid, sibling, midKey, midRid);
+	else
+		rc = node.insertAndSplit(key, rid, -1, sibling, midKey, midRid);
+	if (rc < 0)
+		return rc;
+	
+	PageId siblingPid = pf.endPid();
+	if (node.isLeaf()) {
+		sibling.setNextNodePtr(node.getNextNodePtr());
+		node.setNextNodePtr(siblingPid);
+	}
+	if ((rc = sibling.write(siblingPid, pf)) < 0 || (rc = node.write(pid, pf)) < 0)
+		return rc;
+	overflowKey = midKey;
+	overflowRid = midRid;
+	overflowPid = siblingPid;
+	return 0;
+}
+
+/*
+ * Insert (key, RecordId) pair to the index.
+ * @param key[IN] the value of the record
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::insert(const string& key, const RecordId& rid)
+{
+	RC rc;
+	if (treeHeight == 0) {
+		BTStringNode leaf(STRING_LEAF_NODE, pf.pageSize());
+		if ((rc = leaf.insert(key, rid)) < 0)
+			return rc;
+		rootPid = pf.endPid();
+		treeHeight = 1;
+		return leaf.write(rootPid, pf);
+	}
+	
+	string overflowKey;
+	RecordId overflowRid;
+	PageId overflowPid;
+	if ((rc = insert_recursive(key, rid, rootPid, 1, overflowKey, overflowRid, overflowPid)) < 0)
+		return rc;
+	if (overflowPid < 0)
+		return 0;
+	
+	// The root split, grow a new one
+	BTStringNode root(STRING_NONLEAF_NODE, pf.pageSize());
+	root.initializeRoot(rootPid, overflowKey, overflowRid, overflowPid);
+	root.setLevel(treeHeight);
+	rootPid = pf.endPid();
+	treeHeight++;
+	return root.write(rootPid, pf);
+}
+
+/*
+ * Find the first leaf entry whose string is larger than or equal to
+ * searchKey, and output its location in cursor.
+ * @return error code. 0 if no error.
+ */
+RC BTreeStringIndex::locate(const string& searchKey, IndexCursor& cursor)
+{
+	RC rc;
+	RecordId first;
+	first.pid = first.sid = -1; // before every record with searchKey
+	cursor.postingPid = -1;
+	if (treeHeight == 0) {
+		cursor.pid = RC_END_OF_TREE;
+		cursor.eid = 0;
+		return 0;
+	}
+	
+	PageId pid = rootPid;
+	BTStringNode node;
+	for (int i = 1; i < treeHeight; i++) {
+		if ((rc = node.pin(pid, pf)) < 0)
+			return rc;
+		node.locateChildPtr(searchKey, first, pid);
+	}
+	if ((rc = node.pin(pid, pf)) < 0)
+		return rc;
+	node.locate(searchKey, first, cursor.eid);
+	cursor.pid = pid;
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move foward the cursor to the next entry.
+ * @return error code. 0 if no error, RC_END_OF_TREE past the last entry
+ */
+RC BTreeStringIndex::readForward(IndexCursor& cursor, string& key, RecordId& rid)
+{
+	RC rc;
+	BTStringNode node;
+	while (true) {
+		if (cursor.pid == RC_END_OF_TREE)
+			return RC_END_OF_TREE;
+		if (cursor.pid <= META_PID || cursor.pid >= pf.endPid())
+			return RC_INVALID_CURSOR;
+		if ((rc = node.pin(cursor.pid, pf)) < 0)
+			return rc;
+		if (cursor.eid < node.getKeyCount())
+			break;
+		cursor.eid = 0;
+		cursor.pid = node.getNextNodePtr();
+	}
+	node.readEntry(cursor.eid, key, rid);
+	cursor.eid++;
+	return 0;
+}
+
+bool operator< (const StringEntry& e1, const StringEntry& e2)
+{
+	int c = memcmp(e1.value, e2.value, min(e1.length, e2.length));
+	if (c != 0)
+		return c < 0;
+	if (e1.length != e2.length)
+		return e1.length < e2.length;
+	return e1.rid < e2.rid;
+}
+
+/*
+ * Start a bulk load.
+ * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::beginBulkLoad(double fillFactor)
+{
+	if (!(fillFactor > 0 && fillFactor <= 1))
+		return RC_INVALID_FILL_FACTOR;
+	delete bulk;
+	bulk = new ExternalSort<StringEntry>();
+	bulkFill = fillFactor;
+	return 0;
+}
+
+/*
+ * Add (key, RecordId) pair to the bulk load.
+ * Without a bulk load the pair is inserted right away.
+ * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE if key is longer
+ *         than a value of a table
+ */
+RC BTreeStringIndex::bulkInsert(const string& key, const RecordId& rid)
+{
+	if (bulk == NULL)
+		return insert(key, rid);
+	if (key.size() > sizeof(((StringEntry*) 0)->value))
+		return RC_INVALID_ATTRIBUTE;
+	StringEntry e;
+	e.length = key.size();
+	memcpy(e.value, key.data(), key.size());
+	e.rid = rid;
+	return bulk->add(e);
+}
+
+/*
+ * Finish the bulk load, writing the pairs to the index.
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::endBulkLoad()
+{
+	RC rc;
+	if (bulk == NULL)
+		return 0;
+	
+	if ((rc = bulk->finish()) == 0) {
+		if (treeHeight == 0) {
+			rc = bulk_build();
+		} else {
+			StringEntry e;
+			while ((rc = bulk->next(e)) == 0)
+				if ((rc = insert(string(e.value, e.length), e.rid)) < 0)
+					break;
+			if (rc > 0)
+				rc = 0;
+		}
+	}
+	delete bulk;
+	bulk = NULL;
+	if (rc < 0)
+		return rc;
+	return writeHeader();
+}
+
+/*
+ * Build the tree bottom-up from the sorted pairs of the bulk load.
+ * The leaves are written left to right as in BTreeIndex::bulk_build().
+ * Every level above is built from the pid of each node of the level
+ * below and the separator before it, taken between the last entry of
+ * the leaf on its left and its own first entry.
+ * @return error code. 0 if no error
+ */
+RC BTreeStringIndex::bulk_build()
+{
+	RC rc;
+	int slack = (int) ((1-bulkFill)*pf.pageSize()); // bytes left free in a node
+	vector<PageId> pids;      // the nodes of the level just built
+	vector<string> sepKeys;   // the separator before each of them,
+	vector<RecordId> sepRids; // unused for the first one
+	
+	BTStringNode leaf(STRING_LEAF_NODE, pf.pageSize()), reserved(STRING_LEAF_NODE, pf.pageSize());
+	StringEntry e;
+	string key, last, midKey;
+	RecordId midRid;
+	while ((rc = bulk->next(e)) == 0) {
+		key.assign(e.value, e.length);
+		if (!pids.empty() && leaf.getFreeSpace() > slack && leaf.insert(key, e.rid) == 0) {
+			last.swap(key);
+			continue;
+		}
+		
+		// This leaf is filled, start the next one
+		PageId pid = pf.endPid();
+		if ((rc = reserved.write(pid, pf)) < 0)
+			return rc;
+		if (!pids.empty()) {
+			leaf.setNextNodePtr(pid);
+			if ((rc = leaf.write(pids.back(), pf)) < 0)
+				return rc;
+			BTStringNode::separator(last, key, e.rid, midKey, midRid);
+		}
+		leaf.initBuffer();
+		leaf.insert(key, e.rid);
+		pids.push_back(pid);
+		sepKeys.push_back(midKey);
+		sepRids.push_back(midRid);
+		last.swap(key);
+	}
+	if (rc < 0)
+		return rc;
+	if (pids.empty())
+		return 0;
+	if ((rc = leaf.write(pids.back(), pf)) < 0)
+		return rc;
+	
+	// A node above takes the nodes below until it is filled, but at least
+	// two of them, and leaves no single node over for a node of its own
+	BTStringNode node(STRING_NONLEAF_NODE, pf.pageSize());
+	int height = 1;
+	while (pids.size() > 1) {
+		vector<PageId> upPids;
+		vector<string> upKeys;
+		vector<RecordId> upRids;
+		unsigned i = 0;
+		while (i < pids.size()) {
+			node.initBuffer();
+			node.setLevel(height);
+			node.setFirstChildPtr(pids[i]);
+			upKeys.push_back(sepKeys[i]);
+			upRids.push_back(sepRids[i]);
+			for (i++; i < pids.size(); i++) {
+				bool filled = node.getKeyCount() > 0 && node.getFreeSpace() <= slack && pids.size()-i > 1;
+				if (filled || node.insert(sepKeys[i], sepRids[i], pids[i]) < 0)
+					break;
+			}
+			
+			PageId pid = pf.endPid();
+			if ((rc = node.write(pid, pf)) < 0)
+				return rc;
+			upPids.push_back(pid);
+		}
+		pids.swap(upPids);
+		sepKeys.swap(upKeys);
+		sepRids.swap(upRids);
+		height++;
 	}
+	rootPid = pids[0];
+	treeHeight = height;
 	return 0;
 }
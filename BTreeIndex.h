@@ -10,9 +10,13 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <climits>
+#include <map>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "ExternalSort.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -25,15 +29,64 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // While reading the RecordIds of a posting list: its current page,
+  // the entry number inside that page, and the key.
+  // postingPid is -1 otherwise.
+  PageId  postingPid;
+  int     postingEid;
+  int     postingKey;
 } IndexCursor;
 
+/**
+ * A (key, RecordId) pair waiting to be bulk-loaded into a BTreeIndex.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} KeyEntry;
+
+/**
+ * A (string, RecordId) pair waiting to be bulk-loaded into a
+ * BTreeStringIndex. The string is the first length bytes of value.
+ */
+typedef struct {
+  unsigned short length;
+  char           value[RecordFile::MAX_VALUE_LENGTH];
+  RecordId       rid;
+} StringEntry;
+
+// the orders the entries are sorted in, the same as the index keeps them
+bool operator< (const KeyEntry& e1, const KeyEntry& e2);
+bool operator< (const StringEntry& e1, const StringEntry& e2);
+
+/**
+ * The statistics a BTreeIndex keeps on its keys, for query planning.
+ * The histogram is equi-depth: bucket i holds count[i] RecordIds with
+ * keys up to bound[i] and above bound[i-1] (or from minKey for bucket 0).
+ */
+const int HISTOGRAM_BUCKETS = 32;
+typedef struct {
+  int minKey;     // the smallest key in the index
+  int maxKey;     // the largest key in the index
+  int entryCount; // # RecordIds in the index
+  int leafCount;  // # leaf nodes
+  int buckets;    // # histogram buckets in use
+  int bound[HISTOGRAM_BUCKETS];
+  int count[HISTOGRAM_BUCKETS];
+} IndexStats;
+
+class BTLeafNode;
+class BTNonLeafNode;
+
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ * The nonleaf nodes near the root are kept in memory once read, so that
+ * a lookup reads only its leaf from the buffer pool.
  */
 class BTreeIndex {
  public:
   BTreeIndex();
+  ~BTreeIndex();
 
   /**
    * Open the index file in read or write mode.
@@ -49,12 +102,19 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC close();
-  
-  RC update_root(bool push, int key, const RecordId& rid, PageId pid);
-  RC insert_leaf(int key, const RecordId& rid, PageId pid, int& overflowKey, PageId& overflowPid);
-  RC insert_recursive(int key, const RecordId& rid, PageId pid, int level, int& overflowKey, PageId& overflowPid);
+
+  /**
+   * Write the root pid, tree height, node formats and key statistics to
+   * page 0 of the index file.
+   * @return error code. 0 if no error
+   */
+  RC writeHeader();
+
   /**
    * Insert (key, RecordId) pair to the index.
+   * A key may be inserted more than once. Its RecordIds then stay next to
+   * each other in one leaf in insertion order, and move to a posting list
+   * once there are more than BTLeafNode::getMaxRunLength() of them.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
@@ -78,7 +138,8 @@ class BTreeIndex {
    * to retrieve the actual (key, rid) pair from the index.
    * @param key[IN] the key to find
    * @param cursor[OUT] the cursor pointing to the first index entry
-   * with the key value
+   * with the key value. The cursor may sit just past the end of a node;
+   * readForward() moves on to the next node from there.
    * @return error code. 0 if no error.
    */
   RC locate(int searchKey, IndexCursor& cursor);
@@ -89,19 +150,328 @@ class BTreeIndex {
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error, RC_END_OF_TREE past the last entry
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Find the last leaf-node index entry whose key value is smaller than or
+   * equal to searchKey, for a scan that walks the leaves backward from an
+   * upper bound. The returned cursor points just past the entry;
+   * readBackward() returns the entry and moves on toward smaller keys.
+   * @param searchKey[IN] the largest key to return
+   * @param cursor[OUT] the cursor just past the last index entry with a
+   * key up to searchKey
+   * @return error code. 0 if no error.
+   */
+  RC locateBackward(int searchKey, IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair just before the location specified by the
+   * index cursor, and move the cursor back to it. The RecordIds in the
+   * posting list of a duplicate key still come in list order, while a
+   * run of them kept in the leaf comes back last one first.
+   * @param cursor[IN/OUT] the cursor just past a leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored before the index cursor location
+   * @param rid[OUT] the RecordId stored before the index cursor location
+   * @return error code. 0 if no error, RC_END_OF_TREE before the first entry
+   */
+  RC readBackward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Find the RecordIds of many keys at once. The keys are sorted and the
+   * tree is walked once for all of them: a node on the way is fetched
+   * once for all the keys below it, and so is each leaf.
+   * @param keys[IN] the keys to find, in any order
+   * @param rids[OUT] rids[i] gets the RecordIds of keys[i] in the order
+   *                  readForward() returns them, or nothing if it is not found
+   * @return error code. 0 if no error
+   */
+  RC locateBatch(const std::vector<int>& keys, std::vector<std::vector<RecordId> >& rids);
+
+  /**
+   * Count the RecordIds with a key in [startKey, endKey] without reading
+   * them. Each nonleaf node of a counted index keeps the # RecordIds under
+   * each of its children, so the count comes from the root-to-leaf paths
+   * to the two ends of the range.
+   * @param startKey[IN] the smallest key to count
+   * @param endKey[IN] the largest key to count
+   * @param count[OUT] the # RecordIds in the range
+   * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+   *         index is not counted
+   */
+  RC countRange(int startKey, int endKey, int& count);
+
+  /**
+   * Get the statistics of the index. They are kept on page 0 of the index
+   * file and brought up to date by inserts; close() rebuilds them from
+   * the leaves when they are missing or the index has doubled since they
+   * were last built.
+   * @param stats[OUT] the statistics
+   * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+   *         index has none yet
+   */
+  RC getStats(IndexStats& stats);
+
+  /**
+   * Estimate the # RecordIds with a key in [startKey, endKey] from the
+   * histogram, assuming the keys spread evenly inside each bucket.
+   * @param startKey[IN] the smallest key to count
+   * @param endKey[IN] the largest key to count
+   * @param count[OUT] the estimated # RecordIds in the range
+   * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+   *         index has no statistics yet
+   */
+  RC estimateRange(int startKey, int endKey, int& count);
+
+  /**
+   * Start a bulk load. The pairs given to bulkInsert() are sorted, spilling
+   * to temporary files when they do not fit in memory, and endBulkLoad()
+   * builds the tree from them bottom-up, one level at a time, filling
+   * each node to fillFactor of its capacity. If the index is not empty,
+   * endBulkLoad() inserts the pairs one by one in key order instead.
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error
+   */
+  RC beginBulkLoad(double fillFactor);
+
+  /**
+   * Add (key, RecordId) pair to the bulk load.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * Finish the bulk load, writing the pairs to the index.
+   * close() finishes a bulk load left open.
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+  /**
+   * Make newly created index files store their leaves in the packed
+   * format, which fits about twice the entries per leaf.
+   * Existing index files keep the format they were created with.
+   * @param on[IN] true to pack the leaves
+   */
+  static void setPackedLeaves(bool on) { packLeaves = on; }
+
+  /**
+   * Make newly created index files count the RecordIds under each child
+   * of their nonleaf nodes, for countRange(). An insert then rewrites
+   * every nonleaf node on its path, and the nodes hold a third fewer keys.
+   * Existing index files keep the format they were created with.
+   * @param on[IN] true to count
+   */
+  static void setCountedNodes(bool on) { countNodes = on; }
+
+  /**
+   * Set the # of nonleaf nodes each open index keeps in memory. The nodes
+   * are kept in the order lookups first reach them, the root first.
+   * @param count[IN] the # of nodes to keep (>= 0), 0 to keep none
+   * @return error code. 0 if no error
+   */
+  static RC setUpperCacheSize(int count);
   
  private:
+  friend class BTreeScan;
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
-  /// Note that the content of the above two variables will be gone when
-  /// this class is destructed. Make sure to store the values of the two 
-  /// variables in disk, so that they can be reconstructed when the index
-  /// is opened again later.
+  bool     packedLeaves; /// true if the leaves are in the packed format
+  bool     counted;    /// true if the nonleaf nodes are counted
+  IndexStats stats;    /// the statistics on the keys
+  bool     hasStats;   /// false for an index from before the statistics
+  int      statsBase;  /// stats.entryCount when the histogram was built
+  bool     dirty;      /// true once the index is inserted into
+  /// The variables from rootPid to statsBase live in memory while the
+  /// index is open. writeHeader() saves them to the metadata page (page 0),
+  /// which close() and endBulkLoad() call, and open() reads them back.
+
+  static bool packLeaves; /// true if new index files get packed leaves
+  static bool countNodes; /// true if new index files get counted nonleaf nodes
+
+  std::map<PageId, BTNonLeafNode*> upper; /// the nonleaf nodes kept in memory
+  static int upperCacheSize; /// the most nodes an index keeps in upper
+
+  RC upper_node(PageId pid, BTNonLeafNode& spare, BTNonLeafNode*& node);
+  RC locate_child(PageId pid, int searchKey, PageId& child);
+  void clear_upper();
+
+  RC update_root(bool push, int key, const RecordId& rid, PageId pid, int count);
+  RC insert_leaf(int key, const RecordId& rid, PageId pid, int& overflowKey, PageId& overflowPid, int& overflowCount);
+  RC insert_recursive(int key, const RecordId& rid, PageId pid, int level, int& overflowKey, PageId& overflowPid, int& overflowCount);
+  RC insert_posting(PageId head, const RecordId& rid);
+
+  typedef std::vector<std::pair<int, int> > Probes; /// (key, position) pairs
+  RC locate_batch(PageId pid, int level, const Probes& probes, int from, int to,
+                  std::vector<std::vector<RecordId> >& rids);
+  RC read_posting(PageId head, std::vector<RecordId>& rids);
+
+  RC count_leaf(BTLeafNode& leaf, int from, int to, int& count);
+  RC count_below(int searchKey, int& count);
+  RC count_all(int& count);
+
+  void update_stats(int key);
+  void build_stats(int minKey, const std::vector<int>& maxKeys, const std::vector<int>& counts);
+  RC rebuild_stats();
+
+  ExternalSort<KeyEntry>* bulk; /// the pairs of a bulk load, or NULL
+  double   bulkFill;   /// the fill factor of the bulk load
+
+  RC bulk_posting(const std::vector<RecordId>& rids, PageId& head);
+  RC bulk_build();
+};
+
+/**
+ * Scans the entries of a BTreeIndex in key order over a range of keys.
+ * The entries are copied out of a leaf a batch at a time, so a leaf is
+ * fetched once per batch instead of once per entry, and the next leaf is
+ * reached through the sibling pointer. No page stays pinned between
+ * calls, so the pages of the table can be read while scanning.
+ */
+class BTreeScan {
+ public:
+  static const int BATCH_SIZE = 256; // # entries next() takes at a time
+
+  BTreeScan();
+
+  /**
+   * Start scanning index at the first entry with a key >= startKey.
+   * The scan ends after the last entry with a key <= endKey.
+   * @param index[IN] the open index to scan
+   * @param startKey[IN] the smallest key to return
+   * @param endKey[IN] the largest key to return
+   * @return error code. 0 if no error
+   */
+  RC open(BTreeIndex& index, int startKey = INT_MIN, int endKey = INT_MAX);
+
+  /**
+   * Read the next (key, rid) pair of the scan.
+   * @param key[OUT] the key of the entry
+   * @param rid[OUT] the RecordId of the entry
+   * @return error code. 0 if no error, RC_END_OF_TREE past the last entry
+   */
+  RC next(int& key, RecordId& rid);
+
+  /**
+   * Read the next (key, rid) pairs of the scan, up to max of them.
+   * Fewer than max pairs are returned only at the end of the scan.
+   * @param key[OUT] the keys of the entries, max of them
+   * @param rid[OUT] the RecordIds of the entries, max of them
+   * @param max[IN] the most entries to return
+   * @param count[OUT] the # entries returned, 0 past the last entry
+   * @return error code. 0 if no error
+   */
+  RC nextBatch(int key[], RecordId rid[], int max, int& count);
+
+  /**
+   * End the scan.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+ private:
+  RC fill(int key[], RecordId rid[], int max, int& count);
+
+  BTreeIndex* index;   /// the index being scanned, NULL if not open
+  IndexCursor cursor;  /// the next entry of the index to copy out
+  int endKey;          /// the largest key to return
+  int batchKey[BATCH_SIZE];       /// the entries copied out for next()
+  RecordId batchRid[BATCH_SIZE];
+  int batchCount;      /// # entries in the batch
+  int batchPos;        /// the next entry of the batch to return
+};
+
+/**
+ * Implements a B+tree index on the value column of a table. The keys are
+ * strings compared as strcmp() does; equal strings are kept in rid order.
+ * The same IndexCursor walks its leaves.
+ */
+class BTreeStringIndex {
+ public:
+  BTreeStringIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file should be created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert (key, RecordId) pair to the index.
+   * @param key[IN] the value of the record
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC insert(const std::string& key, const RecordId& rid);
+
+  /**
+   * Find the first leaf entry whose string is larger than or equal to
+   * searchKey, and output its location in cursor.
+   * @param searchKey[IN] the string to find
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return error code. 0 if no error.
+   */
+  RC locate(const std::string& searchKey, IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index cursor,
+   * and move foward the cursor to the next entry.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry
+   * @param key[OUT] the string stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error, RC_END_OF_TREE past the last entry
+   */
+  RC readForward(IndexCursor& cursor, std::string& key, RecordId& rid);
+
+  /**
+   * Start a bulk load, as BTreeIndex::beginBulkLoad() does.
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error
+   */
+  RC beginBulkLoad(double fillFactor);
+
+  /**
+   * Add (key, RecordId) pair to the bulk load.
+   * @param key[IN] the value of the record
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(const std::string& key, const RecordId& rid);
+
+  /**
+   * Finish the bulk load, writing the pairs to the index.
+   * close() finishes a bulk load left open.
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+ private:
+  RC writeHeader();
+  RC bulk_build();
+  RC insert_recursive(const std::string& key, const RecordId& rid, PageId pid, int level,
+                      std::string& overflowKey, RecordId& overflowRid, PageId& overflowPid);
+
+  PageFile pf;         /// the PageFile used to store the actual b+tree in disk
+  PageId   rootPid;    /// the PageId of the root node
+  int      treeHeight; /// the height of the tree
+
+  ExternalSort<StringEntry>* bulk; /// the pairs of a bulk load, or NULL
+  double   bulkFill;   /// the fill factor of the bulk load
 };
 
 #endif /* BTREEINDEX_H */
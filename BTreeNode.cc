@@ -1,28 +1,314 @@
 #include "BTreeNode.h"
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
-BTLeafNode::BTLeafNode() {
+/*
+ * Return the position of the first of the n sorted keys that is
+ * larger than or equal to searchKey (n if there is none).
+ * A branchless binary search halves the range without mispredicted
+ * branches. Built with AVX2 (e.g., make CXXFLAGS=-mavx2), the search
+ * stops at eight keys and compares them in one instruction.
+ */
+static int lowerBound(const int* key, int n, int searchKey)
+{
+	const int* base = key;
+#ifdef __AVX2__
+	while (n > 8) {
+		int half = n/2;
+		base = (base[half] < searchKey) ? base+half : base;
+		n -= half;
+	}
+	// Load the n remaining keys, leaving out anything past them
+	__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i keys = _mm256_maskload_epi32(base, valid);
+	__m256i less = _mm256_and_si256(valid,
+		_mm256_cmpgt_epi32(_mm256_set1_epi32(searchKey), keys));
+	return (base-key) + __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+#else
+	if (n == 0)
+		return 0;
+	while (n > 1) {
+		int half = n/2;
+		base = (base[half] < searchKey) ? base+half : base;
+		n -= half;
+	}
+	return (base-key) + (*base < searchKey);
+#endif
+}
+
+/*
+ * Return the position of the first of the n sorted keys that is
+ * larger than searchKey (n if there is none).
+ */
+static int upperBound(const int* key, int n, int searchKey)
+{
+	if (searchKey == INT_MAX)
+		return n;
+	return lowerBound(key, n, searchKey+1);
+}
+
+/*
+ * Return the fewest bytes (1, 2 or 4) that hold every value up to max.
+ */
+static int packedBytes(unsigned max)
+{
+	if (max <= 0xff)
+		return 1;
+	if (max <= 0xffff)
+		return 2;
+	return 4;
+}
+
+/*
+ * Return the i-th of the values stored bytes bytes apiece from p.
+ */
+static unsigned loadPacked(const char* p, int bytes, int i)
+{
+	unsigned short s;
+	unsigned v;
+	switch (bytes) {
+	case 1:
+		return ((const unsigned char*) p)[i];
+	case 2:
+		memcpy(&s, p+2*i, 2);
+		return s;
+	default:
+		memcpy(&v, p+4*i, 4);
+		return v;
+	}
+}
+
+/*
+ * Store v as the i-th of the values stored bytes bytes apiece from p.
+ */
+static void storePacked(char* p, int bytes, int i, unsigned v)
+{
+	unsigned char c = v;
+	unsigned short s = v;
+	switch (bytes) {
+	case 1:
+		p[i] = c;
+		break;
+	case 2:
+		memcpy(p+2*i, &s, 2);
+		break;
+	default:
+		memcpy(p+4*i, &v, 4);
+		break;
+	}
+}
+
+/*
+ * lowerBound() over n sorted values of type T stored from p.
+ */
+template<class T>
+static int packedLowerBound(const char* p, int n, unsigned offset)
+{
+	T v;
+	int base = 0;
+	if (n == 0)
+		return 0;
+	while (n > 1) {
+		int half = n/2;
+		memcpy(&v, p+(base+half)*sizeof(T), sizeof(T));
+		base = ((unsigned) v < offset) ? base+half : base;
+		n -= half;
+	}
+	memcpy(&v, p+base*sizeof(T), sizeof(T));
+	return base + ((unsigned) v < offset);
+}
+
+BTLeafNode::BTLeafNode(int pageSize) {
+	pinnedFile = NULL;
+	this->pageSize = pageSize;
+	page = new char[pageSize];
+	buffer = page;
 	initBuffer();
 }
 
+BTLeafNode::BTLeafNode(const BTLeafNode& other) {
+	pinnedFile = NULL;
+	pageSize = other.pageSize;
+	page = new char[pageSize];
+	buffer = page;
+	memcpy(page, other.buffer, pageSize);
+}
+
+BTLeafNode::~BTLeafNode() {
+	unpin();
+	delete [] page;
+}
+
+BTLeafNode& BTLeafNode::operator=(const BTLeafNode& other) {
+	if (this != &other) {
+		unpin();
+		setPageSize(other.pageSize);
+		memcpy(page, other.buffer, pageSize);
+	}
+	return *this;
+}
+
+void BTLeafNode::setPageSize(int size)
+{
+	// Only called while unpinned, so buffer is page
+	if (size == pageSize)
+		return;
+	delete [] page;
+	page = new char[size];
+	pageSize = size;
+	buffer = page;
+}
+
 RC BTLeafNode::initBuffer()
 {
-	int* buf = (int*) buffer;
-	for(int i=0;i<256;i++)
-		buf[i]=0;
-	buf[255]=RC_END_OF_TREE;
+	unpin();
+	memset(buffer, 0, pageSize);
+	NodeHeader* h = header();
+	h->type = LEAF_NODE;
+	h->version = NODE_VERSION;
+	h->keyCount = 0;
+	h->level = 0;
+	h->sibling = RC_END_OF_TREE;
+	h->prev = RC_END_OF_TREE;
 	return 0;
 }
 
 RC BTLeafNode::printBuffer(){
-	Entry* buf = (Entry*) buffer;
-	for(int i=0;i<84;i++)
-		cerr << buf[i].key << " ";
+	vector<int> key;
+	vector<RecordId> rid;
+	unpack(key, rid);
+	for(unsigned i=0;i<key.size();i++)
+		cerr << key[i] << " ";
 	cerr << endl;
 	return 0;
 }
 
+/*
+ * Switch the node between the plain and the packed leaf format,
+ * keeping its entries.
+ * @param packed[IN] true for the packed format
+ * @return 0 if successful. Return an error code if the entries do not fit.
+ */
+RC BTLeafNode::setPacked(bool packed)
+{
+	if (packed == isPacked())
+		return 0;
+	vector<int> key;
+	vector<RecordId> rid;
+	unpack(key, rid);
+	
+	short type = header()->type;
+	header()->type = packed ? PACKED_LEAF_NODE : LEAF_NODE;
+	RC rc = pack(key, rid, 0, key.size());
+	if (rc < 0) {
+		// Too many entries for the plain format, stay as it was
+		header()->type = type;
+		pack(key, rid, 0, key.size());
+	}
+	return rc;
+}
+
+/*
+ * Return whether the node is in the packed leaf format.
+ * @return true if the node is packed
+ */
+bool BTLeafNode::isPacked()
+{
+	return header()->type == PACKED_LEAF_NODE;
+}
+
+/*
+ * Decode every entry of the node, whatever its format.
+ * @param key[OUT] the keys of the node
+ * @param rid[OUT] the RecordIds of the node
+ */
+void BTLeafNode::unpack(vector<int>& key, vector<RecordId>& rid)
+{
+	int keyCount = getKeyCount();
+	key.resize(keyCount);
+	rid.resize(keyCount);
+	for(int i=0;i<keyCount;i++)
+		readEntry(i, key[i], rid[i]);
+}
+
+/*
+ * Replace the entries of the node with entries [from, to) of key and rid,
+ * encoded in the format of the node.
+ * @param key[IN] sorted keys
+ * @param rid[IN] the RecordIds that go with the keys
+ * @return 0 if successful. Return RC_NODE_FULL (leaving the node as it
+ *         was) if the entries do not fit.
+ */
+RC BTLeafNode::pack(const vector<int>& key, const vector<RecordId>& rid, int from, int to)
+{
+	int n = to-from;
+	if (n > getMaxKeyCount())
+		return RC_NODE_FULL;
+	
+	if (!isPacked()) {
+		if (n > 0) {
+			memcpy(keys(), &key[from], n*sizeof(int));
+			memcpy(rids(), &rid[from], n*sizeof(RecordId));
+		}
+		header()->keyCount = n;
+		return 0;
+	}
+	
+	// Offsets from the smallest key and pid, in as few bytes as they need
+	PackedHeader ph;
+	memset(&ph, 0, sizeof(ph));
+	unsigned keyRange = 0, pidRange = 0, sidMax = 0;
+	if (n > 0) {
+		ph.baseKey = key[from]; // keys are sorted
+		ph.basePid = rid[from].pid;
+		for(int i=from;i<to;i++)
+			ph.basePid = min(ph.basePid, rid[i].pid);
+		keyRange = (unsigned) key[to-1] - (unsigned) ph.baseKey;
+		for(int i=from;i<to;i++){
+			pidRange = max(pidRange, (unsigned) (rid[i].pid - ph.basePid));
+			sidMax = max(sidMax, (unsigned) rid[i].sid);
+		}
+	}
+	ph.keyBytes = packedBytes(keyRange);
+	ph.pidBytes = packedBytes(pidRange);
+	ph.sidBytes = packedBytes(sidMax);
+	int space = pageSize-sizeof(NodeHeader)-sizeof(PackedHeader);
+	if (n*(ph.keyBytes+ph.pidBytes+ph.sidBytes) > space)
+		return RC_NODE_FULL;
+	
+	*packedHeader() = ph;
+	char* keyData = packedData();
+	char* pidData = keyData+n*ph.keyBytes;
+	char* sidData = pidData+n*ph.pidBytes;
+	for(int i=0;i<n;i++){
+		storePacked(keyData, ph.keyBytes, i, (unsigned) key[from+i] - (unsigned) ph.baseKey);
+		storePacked(pidData, ph.pidBytes, i, rid[from+i].pid - ph.basePid);
+		storePacked(sidData, ph.sidBytes, i, rid[from+i].sid);
+	}
+	header()->keyCount = n;
+	return 0;
+}
+
+/*
+ * Check that the page in the node buffer is a leaf node.
+ * @return 0 if successful. Return an error code if the page is not a leaf.
+ */
+RC BTLeafNode::checkVersion()
+{
+	NodeHeader* h = header();
+	if ((h->type != LEAF_NODE && h->type != PACKED_LEAF_NODE) || h->version != NODE_VERSION)
+		return RC_INVALID_FILE_FORMAT;
+	return 0;
+}
+
 /*
  * Read the content of the node from the page pid in the PageFile pf.
  * @param pid[IN] the PageId to read
@@ -31,7 +317,12 @@ RC BTLeafNode::printBuffer(){
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 {
-	return pf.read(pid,buffer);
+	unpin();
+	setPageSize(pf.pageSize());
+	RC rc = pf.read(pid,buffer);
+	if (rc < 0)
+		return rc;
+	return checkVersion();
 }
     
 /*
@@ -42,25 +333,84 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 { 
+	if (pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
 	return pf.write(pid,buffer);
 }
 
+/*
+ * Pin the page pid in the PageFile pf and use the cached frame as the
+ * content of the node. The node is read-only while pinned.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to pin the page from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::pin(PageId pid, const PageFile& pf)
+{
+	// Already looking at this page, nothing to do
+	if (pinnedFile == &pf && pinnedPid == pid)
+		return 0;
+	unpin();
+	setPageSize(pf.pageSize());
+	
+	const char* frame;
+	RC rc = pf.pin(pid, frame);
+	if (rc < 0)
+		return rc;
+	pinnedFile = &pf;
+	pinnedPid = pid;
+	buffer = const_cast<char*>(frame);
+	if ((rc = checkVersion()) < 0)
+		unpin();
+	return rc;
+}
+
+/*
+ * Release the page pinned by pin() and go back to the node's own buffer.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::unpin()
+{
+	buffer = page;
+	if (pinnedFile == NULL)
+		return 0;
+	RC rc = pinnedFile->unpin(pinnedPid);
+	pinnedFile = NULL;
+	return rc;
+}
+
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
 int BTLeafNode::getKeyCount()
 {
-	// Maximum size of buffer / size of Entry without the pointer at the end
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*)-2*sizeof(int))/(sizeof(Entry));
-	int keyCount=0;
-	Entry* entry=(Entry*) buffer;
-	for(int count=0;count<maxKeyCount;count++){
-		if((entry+count)->key==0)
-			break;
-		keyCount++;
-	}
-	return keyCount;
+	return header()->keyCount;
+}
+
+/*
+ * Return the number of keys the node can hold.
+ * @return the capacity of the node
+ */
+int BTLeafNode::getMaxKeyCount()
+{
+	if (!isPacked())
+		return plainCapacity();
+	// Twice what fits unpacked, so that each half of a split fits
+	// even when the node can no longer be packed at all
+	int unpacked = (pageSize-sizeof(NodeHeader)-sizeof(PackedHeader))/(sizeof(int)+sizeof(RecordId));
+	return 2*unpacked-1;
+}
+
+/*
+ * Return the longest run of entries with one key the node keeps.
+ * @return the longest run
+ */
+int BTLeafNode::getMaxRunLength()
+{
+	// Small enough that moving a split to the end of a run still leaves
+	// each half well within the node
+	return max(2, plainCapacity()/8);
 }
 
 /*
@@ -72,30 +422,35 @@ int BTLeafNode::getKeyCount()
 RC BTLeafNode::insert(int key, const RecordId& rid)
 {
 	int keyCount=getKeyCount();
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*)-2*sizeof(int))/(sizeof(Entry))-1;
-	if (keyCount == maxKeyCount)
-		return 1;	//buffer full
-		
-	Entry* entryBuffer=(Entry*) buffer; //buffer typecasted
+	if (keyCount >= getMaxKeyCount())
+		return RC_NODE_FULL;
 	
-	// Everything is smaller than key, put at end of the node
-	int insertPosition;
-	int errorCheck=locate(key,insertPosition);
-	if (errorCheck){
-		(entryBuffer+insertPosition)->key=key;
-		(entryBuffer+insertPosition)->rid=rid;
-		return 0;
+	// A packed node is re-encoded as a whole
+	if (isPacked()) {
+		vector<int> k;
+		vector<RecordId> r;
+		unpack(k, r);
+		int pos=upper_bound(k.begin(), k.end(), key)-k.begin();
+		k.insert(k.begin()+pos, key);
+		r.insert(r.begin()+pos, rid);
+		return pack(k, r, 0, k.size());
 	}
+		
+	int* keyBuffer=keys();
+	RecordId* ridBuffer=rids();
 	
-	// Shift any larger entries to the right of the array
-	int amountToShift=keyCount-insertPosition;
-	for (int i=amountToShift;i>0;i--){
-		(entryBuffer+insertPosition+i)->key=(entryBuffer+insertPosition+i-1)->key;
-		(entryBuffer+insertPosition+i)->rid=(entryBuffer+insertPosition+i-1)->rid;
-	}
+	// Insert before the first larger key, so equal keys stay in order
+	int insertPosition=upperBound(keyBuffer,keyCount,key);
+	
+	// Shift any larger entries to the right of the arrays
+	memmove(keyBuffer+insertPosition+1, keyBuffer+insertPosition,
+	        (keyCount-insertPosition)*sizeof(int));
+	memmove(ridBuffer+insertPosition+1, ridBuffer+insertPosition,
+	        (keyCount-insertPosition)*sizeof(RecordId));
 	// Modify entry/insert
-	(entryBuffer+insertPosition)->key=key;
-	(entryBuffer+insertPosition)->rid=rid;
+	keyBuffer[insertPosition]=key;
+	ridBuffer[insertPosition]=rid;
+	header()->keyCount=keyCount+1;
 	
 	return 0;
 }
@@ -103,43 +458,60 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 /*
  * Insert the (key, rid) pair to the node
  * and split the node half and half with sibling.
- * The first key of the sibling node is returned in siblingKey.
+ * The last key left in this node is returned in siblingKey.
  * @param key[IN] the key to insert.
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
- * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @param siblingKey[OUT] the separator for the parent: the largest key in this node after split.
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
                               BTLeafNode& sibling, int& siblingKey)
 { 
-	int eid; //insert position
-	locate(key,eid);
-	
-	int keyCount=getKeyCount();
-	int sid=(keyCount+1)/2; // Starting position of entries for siblings(even split)
-	
-	Entry* entryBuffer=(Entry*) buffer; //buffer typecasted
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*)-2*sizeof(int))/(sizeof(Entry))-1;
+	if (sibling.getKeyCount() != 0 || sibling.pageSize != pageSize)
+		return RC_INVALID_ATTRIBUTE;
+
+	// Lay out all keyCount+1 entries in order
+	vector<int> k;
+	vector<RecordId> r;
+	unpack(k, r);
+	int eid=upper_bound(k.begin(), k.end(), key)-k.begin(); //insert position
+	k.insert(k.begin()+eid, key);
+	r.insert(r.begin()+eid, rid);
+	int n=k.size();
 	
-	// Split
-	siblingKey=(entryBuffer+sid)->key;
-	// Start at the split position
-	for(int i=sid;i<keyCount;i++){
-		sibling.insert((entryBuffer+i)->key,(entryBuffer+i)->rid);
-		// Null out the remainder of the original buffer
-		// so keyCount returns the correct value
-		(entryBuffer+i)->key=0;
-		(entryBuffer+i)->rid.pid=0;
-		(entryBuffer+i)->rid.sid=0;
+	// Split half and half, unless that cuts a run of equal keys. Then the
+	// split goes to the nearer end of the run, or failing that the other.
+	int mid=(n+1)/2; // Starting position of entries for siblings(even split)
+	int lo=mid, hi=mid;
+	while (lo > 0 && k[lo-1] == k[lo])
+		lo--;
+	while (hi < n && k[hi-1] == k[hi])
+		hi++;
+	vector<int> splits;
+	if (lo < mid) {
+		if (lo > 0)
+			splits.push_back(lo);
+		if (hi < n)
+			splits.insert(hi-mid < mid-lo ? splits.begin() : splits.end(), hi);
 	}
+	splits.push_back(mid); // a packed node that fits no other way
 	
-	// Insert in appropriate buffer
-	if(eid < sid)
-		insert(key,rid);
-	else
-		sibling.insert(key,rid);
+	// The sibling takes the format of this node
+	RC rc = 0;
+	int sid=mid;
+	sibling.header()->type=header()->type;
+	for (unsigned i = 0; i < splits.size(); i++) {
+		sid=splits[i];
+		if ((rc = sibling.pack(k, r, sid, n)) == 0 && (rc = pack(k, r, 0, sid)) == 0)
+			break;
+	}
+	if (rc < 0)
+		return rc;
 		
+	// The parent sends a key equal to the separator to the left, so the
+	// separator is the largest key on the left, as bulk loading makes it
+	siblingKey=k[sid-1];
 	return 0;
 }
 
@@ -149,24 +521,35 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  * Remeber that all keys inside a B+tree node should be kept sorted.
  * @param searchKey[IN] the key to search for
  * @param eid[OUT] the entry number that contains a key larger than or equalty to searchKey
- * @return 0 if successful. Return an error code if there is an error.
+ * @return 0 if successful. Return 1 if every key is smaller than searchKey.
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-	eid=0;
-	if(searchKey==0) return 0; // Just want the beginning of the page
 	int keyCount=getKeyCount();
-	Entry* entry=(Entry*) buffer;
-	
-	while (eid<keyCount){
-		// Found the key
-		if((entry+eid)->key>=searchKey)
-			return 0;
-		eid++;
+	if (!isPacked())
+		eid=lowerBound(keys(),keyCount,searchKey);
+	else if (keyCount == 0 || searchKey <= packedHeader()->baseKey)
+		eid=0;
+	else {
+		// Compare offsets from the smallest key in the node
+		unsigned offset=(unsigned) searchKey-(unsigned) packedHeader()->baseKey;
+		switch (packedHeader()->keyBytes) {
+		case 1:
+			eid=packedLowerBound<unsigned char>(packedData(),keyCount,offset);
+			break;
+		case 2:
+			eid=packedLowerBound<unsigned short>(packedData(),keyCount,offset);
+			break;
+		default:
+			eid=packedLowerBound<unsigned>(packedData(),keyCount,offset);
+			break;
+		}
 	}
 	
 	// Reached the end of page
-	return 1;
+	if (eid==keyCount)
+		return 1;
+	return 0;
 }
 
 /*
@@ -179,23 +562,81 @@ RC BTLeafNode::locate(int searchKey, int& eid)
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 {
 	if (eid < 0 || eid >= getKeyCount())
-		return 1;
+		return RC_INVALID_CURSOR;
 
-	Entry* entry = (Entry*) buffer + eid;
-	rid = entry->rid;
-	key = entry->key;
+	if (!isPacked()) {
+		rid = rids()[eid];
+		key = keys()[eid];
+		return 0;
+	}
+	
+	PackedHeader* ph = packedHeader();
+	int keyCount = getKeyCount();
+	char* data = packedData();
+	key = (unsigned) ph->baseKey + loadPacked(data, ph->keyBytes, eid);
+	data += keyCount*ph->keyBytes;
+	rid.pid = ph->basePid + loadPacked(data, ph->pidBytes, eid);
+	data += keyCount*ph->pidBytes;
+	rid.sid = loadPacked(data, ph->sidBytes, eid);
 	return 0;
 }
 
+/*
+ * Replace the rid of the eid entry, keeping its key.
+ * @param eid[IN] the entry number to change
+ * @param rid[IN] the new RecordId of the entry
+ * @return 0 if successful. Return RC_NODE_FULL (leaving the node as it
+ *         was) if a packed node cannot hold the new rid.
+ */
+RC BTLeafNode::replaceEntry(int eid, const RecordId& rid)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RC_INVALID_CURSOR;
+	if (!isPacked()) {
+		rids()[eid] = rid;
+		return 0;
+	}
+	
+	vector<int> k;
+	vector<RecordId> r;
+	unpack(k, r);
+	r[eid] = rid;
+	return pack(k, r, 0, k.size());
+}
+
+/*
+ * Remove the eid entry from the node.
+ * @param eid[IN] the entry number to remove
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::removeEntry(int eid)
+{
+	int keyCount = getKeyCount();
+	if (eid < 0 || eid >= keyCount)
+		return RC_INVALID_CURSOR;
+	if (!isPacked()) {
+		memmove(keys()+eid, keys()+eid+1, (keyCount-eid-1)*sizeof(int));
+		memmove(rids()+eid, rids()+eid+1, (keyCount-eid-1)*sizeof(RecordId));
+		header()->keyCount = keyCount-1;
+		return 0;
+	}
+	
+	// Fewer entries always fit
+	vector<int> k;
+	vector<RecordId> r;
+	unpack(k, r);
+	k.erase(k.begin()+eid);
+	r.erase(r.begin()+eid);
+	return pack(k, r, 0, k.size());
+}
+
 /*
  * Return the pid of the next sibling node.
  * @return the PageId of the next sibling node 
  */
 PageId BTLeafNode::getNextNodePtr()
 {
-	// Pointer at the end
-	PageId* pid = (PageId*) (buffer+PageFile::PAGE_SIZE) - 1;
-	return *pid;
+	return header()->sibling;
 }
 
 /*
@@ -205,21 +646,94 @@ PageId BTLeafNode::getNextNodePtr()
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
 {
-	PageId* sib = (PageId*) (buffer+PageFile::PAGE_SIZE) - 1;
-	*sib = pid;
+	header()->sibling = pid;
+	return 0;
+}
+
+/*
+ * Return the pid of the previous sibling node.
+ * @return the PageId of the previous sibling node 
+ */
+PageId BTLeafNode::getPrevNodePtr()
+{
+	return header()->prev;
+}
+
+/*
+ * Set the pid of the previous sibling node.
+ * @param pid[IN] the PageId of the previous sibling node 
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::setPrevNodePtr(PageId pid)
+{
+	header()->prev = pid;
 	return 0;
 }
 
-BTNonLeafNode::BTNonLeafNode() {
+BTNonLeafNode::BTNonLeafNode(int pageSize) {
+	pinnedFile = NULL;
+	this->pageSize = pageSize;
+	page = new char[pageSize];
+	buffer = page;
 	initBuffer();
 }
 
+BTNonLeafNode::BTNonLeafNode(const BTNonLeafNode& other) {
+	pinnedFile = NULL;
+	pageSize = other.pageSize;
+	page = new char[pageSize];
+	buffer = page;
+	memcpy(page, other.buffer, pageSize);
+}
+
+BTNonLeafNode::~BTNonLeafNode() {
+	unpin();
+	delete [] page;
+}
+
+BTNonLeafNode& BTNonLeafNode::operator=(const BTNonLeafNode& other) {
+	if (this != &other) {
+		unpin();
+		setPageSize(other.pageSize);
+		memcpy(page, other.buffer, pageSize);
+	}
+	return *this;
+}
+
+void BTNonLeafNode::setPageSize(int size)
+{
+	// Only called while unpinned, so buffer is page
+	if (size == pageSize)
+		return;
+	delete [] page;
+	page = new char[size];
+	pageSize = size;
+	buffer = page;
+}
+
 RC BTNonLeafNode::initBuffer()
 {
-	int* buf = (int*) buffer;
-	for(int i=0;i<256;i++)
-		buf[i]=0;
-	buf[255]=RC_END_OF_TREE;
+	unpin();
+	memset(buffer, 0, pageSize);
+	NodeHeader* h = header();
+	h->type = NONLEAF_NODE;
+	h->version = NODE_VERSION;
+	h->keyCount = 0;
+	h->level = 1;
+	h->sibling = RC_END_OF_TREE;
+	h->prev = RC_END_OF_TREE;
+	return 0;
+}
+
+/*
+ * Check that the page in the node buffer is a nonleaf node.
+ * @return 0 if successful. Return an error code if the page is not a nonleaf.
+ */
+RC BTNonLeafNode::checkVersion()
+{
+	NodeHeader* h = header();
+	if ((h->type != NONLEAF_NODE && h->type != COUNTED_NONLEAF_NODE) || h->version != NODE_VERSION)
+		return RC_INVALID_FILE_FORMAT;
 	return 0;
 }
 
@@ -231,7 +745,12 @@ RC BTNonLeafNode::initBuffer()
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 {
-	return pf.read(pid,buffer);
+	unpin();
+	setPageSize(pf.pageSize());
+	RC rc = pf.read(pid,buffer);
+	if (rc < 0)
+		return rc;
+	return checkVersion();
 }
     
 /*
@@ -242,58 +761,201 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 {
+	if (pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
 	return pf.write(pid,buffer);
 }
 
+/*
+ * Pin the page pid in the PageFile pf and use the cached frame as the
+ * content of the node. The node is read-only while pinned.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to pin the page from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::pin(PageId pid, const PageFile& pf)
+{
+	// Already looking at this page, nothing to do
+	if (pinnedFile == &pf && pinnedPid == pid)
+		return 0;
+	unpin();
+	setPageSize(pf.pageSize());
+	
+	const char* frame;
+	RC rc = pf.pin(pid, frame);
+	if (rc < 0)
+		return rc;
+	pinnedFile = &pf;
+	pinnedPid = pid;
+	buffer = const_cast<char*>(frame);
+	if ((rc = checkVersion()) < 0)
+		unpin();
+	return rc;
+}
+
+/*
+ * Release the page pinned by pin() and go back to the node's own buffer.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::unpin()
+{
+	buffer = page;
+	if (pinnedFile == NULL)
+		return 0;
+	RC rc = pinnedFile->unpin(pinnedPid);
+	pinnedFile = NULL;
+	return rc;
+}
+
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
 int BTNonLeafNode::getKeyCount()
 {
-	// Same as BTLeafNode
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*)-2*sizeof(int))/(sizeof(Entry));
-	int keyCount=0;
-	Entry* entry=(Entry*) (buffer);
-	for(int count=0;count<maxKeyCount;count++){
-		if((entry+count)->key!=0)
-			keyCount++;
+	return header()->keyCount;
+}
+
+/*
+ * Return the number of keys the node can hold.
+ * @return the capacity of the node
+ */
+int BTNonLeafNode::getMaxKeyCount()
+{
+	// Whatever follows the header and the leading pointer (and its count),
+	// one key and one pointer (and its count) per entry
+	if (isCounted())
+		return (pageSize-sizeof(NodeHeader)-sizeof(PageId)-sizeof(int))/(2*sizeof(int)+sizeof(PageId));
+	return (pageSize-sizeof(NodeHeader)-sizeof(PageId))/(sizeof(int)+sizeof(PageId));
+}
+
+/*
+ * Return the level of the node, 1 for the parents of the leaves.
+ * @return the level of the node
+ */
+int BTNonLeafNode::getLevel()
+{
+	return header()->level;
+}
+
+/*
+ * Set the level of the node.
+ * @param level[IN] the level of the node, 1 for the parents of the leaves
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::setLevel(int level)
+{
+	header()->level = level;
+	return 0;
+}
+
+/*
+ * Switch the node between the plain and the counted format,
+ * keeping its keys and pointers. The counts start at 0.
+ * @param counted[IN] true for the counted format
+ * @return 0 if successful. Return an error code if the entries do not fit.
+ */
+RC BTNonLeafNode::setCounted(bool counted)
+{
+	if (counted == isCounted())
+		return 0;
+	int keyCount=getKeyCount();
+	vector<int> key(keys(), keys()+keyCount);
+	vector<PageId> pid(pids(), pids()+keyCount+1);
+	
+	short type = header()->type;
+	header()->type = counted ? COUNTED_NONLEAF_NODE : NONLEAF_NODE;
+	if (keyCount > getMaxKeyCount()) {
+		header()->type = type;
+		return RC_NODE_FULL;
 	}
-	return keyCount;
+	memset(buffer+sizeof(NodeHeader), 0, pageSize-sizeof(NodeHeader));
+	memcpy(keys(), &key[0], keyCount*sizeof(int));
+	memcpy(pids(), &pid[0], (keyCount+1)*sizeof(PageId));
+	return 0;
+}
+
+/*
+ * Return whether the node is in the counted format.
+ * @return true if the node keeps counts
+ */
+bool BTNonLeafNode::isCounted()
+{
+	return header()->type == COUNTED_NONLEAF_NODE;
+}
+
+/*
+ * Return the # RecordIds under a pointer of a counted node.
+ * @param eid[IN] the position of the pointer, 0 for the leading one
+ * @return the count, 0 if the node is not counted
+ */
+int BTNonLeafNode::getChildCount(int eid)
+{
+	if (!isCounted() || eid < 0 || eid > getKeyCount())
+		return 0;
+	return counts()[eid];
+}
+
+/*
+ * Set the # RecordIds under a pointer of a counted node.
+ * @param eid[IN] the position of the pointer, 0 for the leading one
+ * @param count[IN] the count
+ * @return 0 if successful. Return an error code if the node is not counted.
+ */
+RC BTNonLeafNode::setChildCount(int eid, int count)
+{
+	if (!isCounted() || eid < 0 || eid > getKeyCount())
+		return RC_INVALID_ATTRIBUTE;
+	counts()[eid] = count;
+	return 0;
 }
 
+/*
+ * Return the # RecordIds under the pointers before position eid.
+ * @param eid[IN] the position of the first pointer not counted
+ * @return the count, 0 if the node is not counted
+ */
+int BTNonLeafNode::countBefore(int eid)
+{
+	if (!isCounted())
+		return 0;
+	int total=0;
+	for(int i=0;i<eid && i<=getKeyCount();i++)
+		total+=counts()[i];
+	return total;
+}
 
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the # RecordIds under pid, kept by a counted node
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
+RC BTNonLeafNode::insert(int key, PageId pid, int count)
 { 
 	int keyCount=getKeyCount();
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*)-2*sizeof(int))/(sizeof(Entry));
-	if (keyCount == maxKeyCount)
-		return 1;	//buffer full
+	if (keyCount >= getMaxKeyCount())
+		return RC_NODE_FULL;
 		
-	// Get position to insert
-	// Offset for the initial pointer
-	Entry* entryBuffer=(Entry*)(buffer+sizeof(PageId*)); //buffer typecasted
-	int eid;
-	for(eid=0;eid<keyCount;eid++)
-		if(((entryBuffer+eid))->key>key)
-			break;
+	// Get position to insert, after any equal keys
+	int* keyBuffer=keys();
+	PageId* pidBuffer=pids()+1; // pid i+1 goes with key i
+	int eid=upperBound(keyBuffer,keyCount,key);
 			
-	// Shift any larger entries to the right of the array
-	int amountToShift=keyCount-eid;
-	for (int i=amountToShift;i>=0;i--){
-		(entryBuffer+eid+i+1)->key=(entryBuffer+eid+i)->key;
-		(entryBuffer+eid+i+1)->pid=(entryBuffer+eid+i)->pid;
+	// Shift any larger entries to the right of the arrays
+	memmove(keyBuffer+eid+1, keyBuffer+eid, (keyCount-eid)*sizeof(int));
+	memmove(pidBuffer+eid+1, pidBuffer+eid, (keyCount-eid)*sizeof(PageId));
+	if (isCounted()) {
+		int* countBuffer=counts()+1;
+		memmove(countBuffer+eid+1, countBuffer+eid, (keyCount-eid)*sizeof(int));
+		countBuffer[eid]=count;
 	}
 	
 	// Modify entry/insert
-	(entryBuffer+eid)->key=key;
-	(entryBuffer+eid)->pid=pid;
+	keyBuffer[eid]=key;
+	pidBuffer[eid]=pid;
+	header()->keyCount=keyCount+1;
 	return 0;
 }
 
@@ -305,75 +967,76 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  * @param pid[IN] the PageId to insert
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @param count[IN] the # RecordIds under pid, kept by a counted node
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int count)
 { 
-	// Get position to insert
-	Entry* entryBuffer=(Entry*) (buffer+sizeof(PageId*)); //buffer typecasted
+	if (sibling.getKeyCount() != 0 || sibling.pageSize != pageSize)
+		return RC_INVALID_ATTRIBUTE;
+
+	// Lay out all keyCount+1 keys and keyCount+2 pointers in order,
+	// then cut them in two
 	int keyCount=getKeyCount();
-	int eid;
-	for(eid=0;eid<keyCount;eid++)
-		if(((entryBuffer+eid))->key>key)
-			break;
+	vector<int> allKeys(keys(), keys()+keyCount);
+	vector<PageId> allPids(pids(), pids()+keyCount+1);
+	vector<int> allCounts(keyCount+1, 0);
+	if (isCounted())
+		allCounts.assign(counts(), counts()+keyCount+1);
+	int eid=upperBound(&allKeys[0],keyCount,key);
+	allKeys.insert(allKeys.begin()+eid, key);
+	allPids.insert(allPids.begin()+eid+1, pid);
+	allCounts.insert(allCounts.begin()+eid+1, count);
 
-	int sid=(keyCount+1)/2; // Starting position of entries for siblings(even split)
-	// Do normal insert
-	// Shift any larger entries to the right of the array
-	Entry temp; // Hold last entry since it might be overwritten
-	int maxKeyCount=(PageFile::PAGE_SIZE-sizeof(PageId*))/(sizeof(Entry));
-	
-	// Split
-	midKey=(entryBuffer+sid)->key;
-	for(int i=sid+1;i<keyCount;i++){
-		sibling.insert((entryBuffer+i)->key,(entryBuffer+i)->pid);
-		(entryBuffer+i)->key=0;
-		(entryBuffer+i)->pid=0;
-	}
-	
-	// Insert in appropriate buffer
-	if(eid < sid)
-		insert(key,pid);
-	else
-		sibling.insert(key,pid);
+	// The middle key moves up to the parent and the pointer after it
+	// becomes the sibling's leading pointer. The sibling takes the
+	// format of this node.
+	int mid=(keyCount+1)/2;
+	midKey=allKeys[mid];
+	sibling.header()->type=header()->type;
+	memcpy(sibling.keys(), &allKeys[mid+1], (keyCount-mid)*sizeof(int));
+	memcpy(sibling.pids(), &allPids[mid+1], (keyCount-mid+1)*sizeof(PageId));
+	if (isCounted())
+		memcpy(sibling.counts(), &allCounts[mid+1], (keyCount-mid+1)*sizeof(int));
+	sibling.header()->keyCount=keyCount-mid;
+	sibling.setLevel(getLevel());
+
+	memcpy(keys(), &allKeys[0], mid*sizeof(int));
+	memcpy(pids(), &allPids[0], (mid+1)*sizeof(PageId));
+	if (isCounted())
+		memcpy(counts(), &allCounts[0], (mid+1)*sizeof(int));
+	header()->keyCount=mid;
 	
 	return 0;
 }
 
 /*
  * Given the searchKey, find the child-node pointer to follow and
- * output it in pid.
+ * output it in pid. An equal key leads to the child on its left.
  * @param searchKey[IN] the searchKey that is being looked up.
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 {
-	// To check the first key and possibly use the leading pointer
-	// we typecasted the buffer temporarily so that we can access
-	// it easily
-	struct checkInitial{
-		PageId pid;
-		int key;
-	};
-	checkInitial* tempBuffer=(checkInitial*) buffer;
-	if (searchKey<(tempBuffer->key)){
-		pid=tempBuffer->pid;
-		return 0;
-	}
-	
-	// Resume normal typecasting
-	Entry* entryBuffer=(Entry*) (buffer+sizeof(PageId*));
-	int eid;
-	int keyCount=getKeyCount();
-	for(eid=0;eid<keyCount;eid++)
-		if(((entryBuffer+eid))->key>=searchKey)
-		{
-			pid=(entryBuffer+eid-1)->pid;
-			return 0;
-		}
-	// Reached the end of the array
-	pid=(entryBuffer+keyCount-1)->pid;
+	// Every key before eid is smaller than searchKey,
+	// so pointer eid leads to the keys in (key eid-1, key eid]
+	int eid=lowerBound(keys(),getKeyCount(),searchKey);
+	pid=pids()[eid];
+	return 0;
+}
+
+/*
+ * Find the child-node pointer to follow for searchKey and its position.
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param pid[OUT] the pointer to the child node to follow.
+ * @param eid[OUT] the position of the pointer, 0 for the leading one.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid, int& eid)
+{
+	eid=lowerBound(keys(),getKeyCount(),searchKey);
+	pid=pids()[eid];
 	return 0;
 }
 
@@ -386,15 +1049,650 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
  */
 RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
 {	
-	// Typecast the buffer in this special format to make initializing easier
-	struct format{
-		PageId pid1;
-		int key;
-		PageId pid2;
-	};
-	format* formatBuffer=(format*) buffer;
-	formatBuffer->pid1=pid1;
-	formatBuffer->pid2=pid2;
-	formatBuffer->key=key;
+	keys()[0]=key;
+	pids()[0]=pid1;
+	pids()[1]=pid2;
+	header()->keyCount=1;
+	return 0;
+}
+
+BTPostingNode::BTPostingNode(int pageSize) {
+	pinnedFile = NULL;
+	this->pageSize = pageSize;
+	page = new char[pageSize];
+	buffer = page;
+	initBuffer();
+}
+
+BTPostingNode::~BTPostingNode() {
+	unpin();
+	delete [] page;
+}
+
+void BTPostingNode::setPageSize(int size)
+{
+	// Only called while unpinned, so buffer is page
+	if (size == pageSize)
+		return;
+	delete [] page;
+	page = new char[size];
+	pageSize = size;
+	buffer = page;
+}
+
+RC BTPostingNode::initBuffer()
+{
+	unpin();
+	memset(buffer, 0, pageSize);
+	NodeHeader* h = header();
+	h->type = POSTING_NODE;
+	h->version = NODE_VERSION;
+	h->keyCount = 0;
+	h->level = 0;
+	h->sibling = RC_END_OF_TREE;
+	h->prev = RC_END_OF_TREE;
+	postingHeader()->last = RC_END_OF_TREE;
+	postingHeader()->total = 0;
+	return 0;
+}
+
+/*
+ * Check that the page in the node buffer is a posting page.
+ * @return 0 if successful. Return an error code if the page is not a posting page.
+ */
+RC BTPostingNode::checkVersion()
+{
+	NodeHeader* h = header();
+	if (h->type != POSTING_NODE || h->version != NODE_VERSION)
+		return RC_INVALID_FILE_FORMAT;
+	return 0;
+}
+
+/*
+ * Read the content of the page from the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::read(PageId pid, const PageFile& pf)
+{
+	unpin();
+	setPageSize(pf.pageSize());
+	RC rc = pf.read(pid,buffer);
+	if (rc < 0)
+		return rc;
+	return checkVersion();
+}
+
+/*
+ * Write the content of the page to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::write(PageId pid, PageFile& pf)
+{
+	if (pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
+	return pf.write(pid,buffer);
+}
+
+/*
+ * Pin the page pid in the PageFile pf and use the cached frame as the
+ * content of the node. The node is read-only while pinned.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to pin the page from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::pin(PageId pid, const PageFile& pf)
+{
+	// Already looking at this page, nothing to do
+	if (pinnedFile == &pf && pinnedPid == pid)
+		return 0;
+	unpin();
+	setPageSize(pf.pageSize());
+	
+	const char* frame;
+	RC rc = pf.pin(pid, frame);
+	if (rc < 0)
+		return rc;
+	pinnedFile = &pf;
+	pinnedPid = pid;
+	buffer = const_cast<char*>(frame);
+	if ((rc = checkVersion()) < 0)
+		unpin();
+	return rc;
+}
+
+/*
+ * Release the page pinned by pin() and go back to the node's own buffer.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::unpin()
+{
+	buffer = page;
+	if (pinnedFile == NULL)
+		return 0;
+	RC rc = pinnedFile->unpin(pinnedPid);
+	pinnedFile = NULL;
+	return rc;
+}
+
+/*
+ * Add rid at the end of the page.
+ * @param rid[IN] the RecordId to add
+ * @return 0 if successful. Return RC_NODE_FULL if the page is full.
+ */
+RC BTPostingNode::append(const RecordId& rid)
+{
+	int count = getCount();
+	if (count >= getMaxCount())
+		return RC_NODE_FULL;
+	rids()[count] = rid;
+	header()->keyCount = count+1;
+	return 0;
+}
+
+/*
+ * Read the eid-th RecordId of the page.
+ * @param eid[IN] the entry number to read
+ * @param rid[OUT] the RecordId in the entry
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::readEntry(int eid, RecordId& rid)
+{
+	if (eid < 0 || eid >= getCount())
+		return RC_INVALID_CURSOR;
+	rid = rids()[eid];
+	return 0;
+}
+
+/*
+ * Return the number of RecordIds in the page.
+ * @return the number of RecordIds in the page
+ */
+int BTPostingNode::getCount()
+{
+	return header()->keyCount;
+}
+
+/*
+ * Return the number of RecordIds the page can hold.
+ * @return the capacity of the page
+ */
+int BTPostingNode::getMaxCount()
+{
+	return (pageSize-sizeof(NodeHeader)-sizeof(PostingHeader))/sizeof(RecordId);
+}
+
+/*
+ * Return the pid of the next page of the list.
+ * @return the PageId of the next page, RC_END_OF_TREE on the last page
+ */
+PageId BTPostingNode::getNextNodePtr()
+{
+	return header()->sibling;
+}
+
+/*
+ * Set the pid of the next page of the list.
+ * @param pid[IN] the PageId of the next page
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::setNextNodePtr(PageId pid)
+{
+	header()->sibling = pid;
+	return 0;
+}
+
+/*
+ * Return the pid of the last page of the list (first page only).
+ * @return the PageId of the last page
+ */
+PageId BTPostingNode::getLastNodePtr()
+{
+	return postingHeader()->last;
+}
+
+/*
+ * Set the pid of the last page of the list (first page only).
+ * @param pid[IN] the PageId of the last page
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::setLastNodePtr(PageId pid)
+{
+	postingHeader()->last = pid;
+	return 0;
+}
+
+/*
+ * Return the number of RecordIds in the whole list (first page only).
+ * @return the length of the list
+ */
+int BTPostingNode::getTotalCount()
+{
+	return postingHeader()->total;
+}
+
+/*
+ * Set the number of RecordIds in the whole list (first page only).
+ * @param count[IN] the length of the list
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::setTotalCount(int count)
+{
+	postingHeader()->total = count;
+	return 0;
+}
+
+// Sorts before the rid of any record, for separators and searches
+// that stand for every record with a given string
+static const RecordId FIRST_RID = { -1, -1 };
+
+BTStringNode::BTStringNode(short type, int pageSize) {
+	pinnedFile = NULL;
+	this->type = type;
+	this->pageSize = pageSize;
+	page = new char[pageSize];
+	buffer = page;
+	initBuffer();
+}
+
+BTStringNode::~BTStringNode() {
+	unpin();
+	delete [] page;
+}
+
+void BTStringNode::setPageSize(int size)
+{
+	// Only called while unpinned, so buffer is page
+	if (size == pageSize)
+		return;
+	delete [] page;
+	page = new char[size];
+	pageSize = size;
+	buffer = page;
+}
+
+RC BTStringNode::initBuffer()
+{
+	unpin();
+	memset(buffer, 0, pageSize);
+	NodeHeader* h = header();
+	h->type = type;
+	h->version = NODE_VERSION;
+	h->keyCount = 0;
+	h->level = (type == STRING_LEAF_NODE) ? 0 : 1;
+	h->sibling = RC_END_OF_TREE;
+	h->prev = RC_END_OF_TREE;
+	stringHeader()->heapUsed = 0;
+	stringHeader()->firstChild = -1;
+	return 0;
+}
+
+/*
+ * Check that the page in the node buffer is a string node.
+ * @return 0 if successful. Return an error code if the page is not a string node.
+ */
+RC BTStringNode::checkVersion()
+{
+	NodeHeader* h = header();
+	if ((h->type != STRING_LEAF_NODE && h->type != STRING_NONLEAF_NODE) || h->version != NODE_VERSION)
+		return RC_INVALID_FILE_FORMAT;
 	return 0;
 }
+
+/*
+ * Read the content of the node from the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::read(PageId pid, const PageFile& pf)
+{
+	unpin();
+	setPageSize(pf.pageSize());
+	RC rc = pf.read(pid,buffer);
+	if (rc < 0)
+		return rc;
+	return checkVersion();
+}
+
+/*
+ * Write the content of the node to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::write(PageId pid, PageFile& pf)
+{
+	if (pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
+	return pf.write(pid,buffer);
+}
+
+/*
+ * Pin the page pid in the PageFile pf and use the cached frame as the
+ * content of the node. The node is read-only while pinned.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to pin the page from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::pin(PageId pid, const PageFile& pf)
+{
+	// Already looking at this page, nothing to do
+	if (pinnedFile == &pf && pinnedPid == pid)
+		return 0;
+	unpin();
+	setPageSize(pf.pageSize());
+	
+	const char* frame;
+	RC rc = pf.pin(pid, frame);
+	if (rc < 0)
+		return rc;
+	pinnedFile = &pf;
+	pinnedPid = pid;
+	buffer = const_cast<char*>(frame);
+	if ((rc = checkVersion()) < 0)
+		unpin();
+	return rc;
+}
+
+/*
+ * Release the page pinned by pin() and go back to the node's own buffer.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::unpin()
+{
+	buffer = page;
+	if (pinnedFile == NULL)
+		return 0;
+	RC rc = pinnedFile->unpin(pinnedPid);
+	pinnedFile = NULL;
+	return rc;
+}
+
+bool BTStringNode::isLeaf()
+{
+	return header()->type == STRING_LEAF_NODE;
+}
+
+int BTStringNode::getKeyCount()
+{
+	return header()->keyCount;
+}
+
+int BTStringNode::getLevel()
+{
+	return header()->level;
+}
+
+RC BTStringNode::setLevel(int level)
+{
+	header()->level = level;
+	return 0;
+}
+
+PageId BTStringNode::getNextNodePtr()
+{
+	return header()->sibling;
+}
+
+RC BTStringNode::setNextNodePtr(PageId pid)
+{
+	header()->sibling = pid;
+	return 0;
+}
+
+/*
+ * Compare entry eid with (key, rid): the strings byte by byte as
+ * strcmp() does, then the rids.
+ * @return <0, 0 or >0 as the entry is smaller, equal or larger
+ */
+int BTStringNode::compare(int eid, const string& key, const RecordId& rid)
+{
+	Slot* s = slot(eid);
+	int length = s->length;
+	int c = memcmp(keyOf(s), key.data(), min(length, (int) key.size()));
+	if (c != 0)
+		return c;
+	if (length != (int) key.size())
+		return length < (int) key.size() ? -1 : 1;
+	if (s->rid < rid)
+		return -1;
+	if (s->rid > rid)
+		return 1;
+	return 0;
+}
+
+/*
+ * Return the first entry larger than or equal to (key, rid),
+ * getKeyCount() if there is none.
+ */
+int BTStringNode::search(const string& key, const RecordId& rid)
+{
+	int lo = 0, hi = getKeyCount();
+	while (lo < hi) {
+		int mid = (lo+hi)/2;
+		if (compare(mid, key, rid) < 0)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Insert an entry to the node, keeping the entries sorted.
+ * @return 0 if successful. Return RC_NODE_FULL if the node is full.
+ */
+RC BTStringNode::insert(const string& key, const RecordId& rid, PageId pid)
+{
+	int keyCount = getKeyCount();
+	int used = sizeof(NodeHeader)+sizeof(StringHeader)+(keyCount+1)*slotSize()
+	         + stringHeader()->heapUsed+key.size();
+	if (used > pageSize)
+		return RC_NODE_FULL;
+	
+	// Make room for the slot, and put the string below the others
+	int eid = search(key, rid);
+	memmove(slot(eid+1), slot(eid), (keyCount-eid)*slotSize());
+	int end = stringHeader()->heapUsed+key.size();
+	memcpy(buffer+pageSize-end, key.data(), key.size());
+	stringHeader()->heapUsed = end;
+	
+	Slot* s = slot(eid);
+	s->end = end;
+	s->length = key.size();
+	s->rid = rid;
+	if (!isLeaf())
+		*child(eid) = pid;
+	header()->keyCount = keyCount+1;
+	return 0;
+}
+
+/*
+ * Decode all entries of the node.
+ */
+void BTStringNode::unpack(vector<string>& key, vector<RecordId>& rid, vector<PageId>& pid)
+{
+	int keyCount = getKeyCount();
+	key.resize(keyCount);
+	rid.resize(keyCount);
+	pid.resize(keyCount);
+	for (int i = 0; i < keyCount; i++) {
+		Slot* s = slot(i);
+		key[i].assign(keyOf(s), s->length);
+		rid[i] = s->rid;
+		pid[i] = isLeaf() ? -1 : *child(i);
+	}
+}
+
+/*
+ * Replace the entries of the node with entries [from, to) of the vectors.
+ * @return 0 if successful. Return RC_NODE_FULL (leaving the node as it
+ *         was) if the entries do not fit.
+ */
+RC BTStringNode::pack(const vector<string>& key, const vector<RecordId>& rid,
+                      const vector<PageId>& pid, int from, int to)
+{
+	int used = sizeof(NodeHeader)+sizeof(StringHeader)+(to-from)*slotSize();
+	for (int i = from; i < to; i++)
+		used += key[i].size();
+	if (used > pageSize)
+		return RC_NODE_FULL;
+	
+	header()->keyCount = 0;
+	stringHeader()->heapUsed = 0;
+	for (int i = from; i < to; i++)
+		insert(key[i], rid[i], pid[i]);
+	return 0;
+}
+
+/*
+ * Insert an entry to the node and split the node with sibling,
+ * about half of the bytes going to each.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::insertAndSplit(const string& key, const RecordId& rid, PageId pid,
+                                BTStringNode& sibling, string& midKey, RecordId& midRid)
+{
+	if (sibling.getKeyCount() != 0 || sibling.pageSize != pageSize)
+		return RC_INVALID_ATTRIBUTE;
+
+	// Lay out all entries in order
+	vector<string> k;
+	vector<RecordId> r;
+	vector<PageId> p;
+	unpack(k, r, p);
+	int eid = search(key, rid);
+	k.insert(k.begin()+eid, key);
+	r.insert(r.begin()+eid, rid);
+	p.insert(p.begin()+eid, pid);
+	int total = k.size();
+	
+	// Cut where half of the bytes are on each side
+	int all = 0, before = 0, sid;
+	for (int i = 0; i < total; i++)
+		all += slotSize()+k[i].size();
+	for (sid = 0; sid < total; sid++) {
+		int size = slotSize()+k[sid].size();
+		if (2*before+size >= all)
+			break;
+		before += size;
+	}
+	sid = max(1, min(sid, total-1));
+	
+	sibling.header()->type = header()->type;
+	sibling.setLevel(getLevel());
+	RC rc;
+	if (isLeaf()) {
+		if ((rc = sibling.pack(k, r, p, sid, total)) < 0)
+			return rc;
+		if ((rc = pack(k, r, p, 0, sid)) < 0)
+			return rc;
+		
+		// The parent only needs something between the two nodes
+		separator(k[sid-1], k[sid], r[sid], midKey, midRid);
+	} else {
+		// The middle separator moves up, its child starts the sibling
+		midKey = k[sid];
+		midRid = r[sid];
+		sibling.stringHeader()->firstChild = p[sid];
+		if ((rc = sibling.pack(k, r, p, sid+1, total)) < 0)
+			return rc;
+		if ((rc = pack(k, r, p, 0, sid)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Find the first leaf entry larger than or equal to (searchKey, rid).
+ * @return 0 if successful. Return 1 if every entry is smaller.
+ */
+RC BTStringNode::locate(const string& searchKey, const RecordId& rid, int& eid)
+{
+	eid = search(searchKey, rid);
+	return eid == getKeyCount() ? 1 : 0;
+}
+
+/*
+ * Find the child of a nonleaf to follow for (searchKey, rid).
+ * A separator leads to the keys larger than or equal to it.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::locateChildPtr(const string& searchKey, const RecordId& rid, PageId& pid)
+{
+	// # separators <= (searchKey, rid)
+	int eid = search(searchKey, rid);
+	if (eid < getKeyCount() && compare(eid, searchKey, rid) == 0)
+		eid++;
+	pid = (eid == 0) ? stringHeader()->firstChild : *child(eid-1);
+	return 0;
+}
+
+/*
+ * Read the eid entry.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::readEntry(int eid, string& key, RecordId& rid)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RC_INVALID_CURSOR;
+	Slot* s = slot(eid);
+	key.assign(keyOf(s), s->length);
+	rid = s->rid;
+	return 0;
+}
+
+/*
+ * Initialize a nonleaf root with (pid1, separator, pid2).
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::initializeRoot(PageId pid1, const string& key, const RecordId& rid, PageId pid2)
+{
+	stringHeader()->firstChild = pid1;
+	header()->keyCount = 0;
+	stringHeader()->heapUsed = 0;
+	return insert(key, rid, pid2);
+}
+
+/*
+ * Set the child of a nonleaf with the keys below its first separator.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::setFirstChildPtr(PageId pid)
+{
+	stringHeader()->firstChild = pid;
+	return 0;
+}
+
+/*
+ * Return the number of bytes not used by the slots and strings.
+ */
+int BTStringNode::getFreeSpace()
+{
+	return pageSize-sizeof(NodeHeader)-sizeof(StringHeader)
+	     - getKeyCount()*slotSize()-stringHeader()->heapUsed;
+}
+
+/*
+ * Pick a separator between two adjacent leaf entries: the shortest
+ * prefix of the right string that is above the left one, or the whole
+ * right entry if the strings match.
+ */
+void BTStringNode::separator(const string& leftKey, const string& rightKey,
+                             const RecordId& rightRid, string& midKey, RecordId& midRid)
+{
+	if (leftKey == rightKey) {
+		midKey = rightKey;
+		midRid = rightRid;
+		return;
+	}
+	unsigned common = 0;
+	while (common < leftKey.size() && leftKey[common] == rightKey[common])
+		common++;
+	midKey = rightKey.substr(0, common+1);
+	midRid = FIRST_RID;
+}
@@ -10,20 +10,87 @@
 #ifndef BTNODE_H
 #define BTNODE_H
 
+#include <string>
+#include <vector>
 #include "RecordFile.h"
 #include "PageFile.h"
 
+/**
+ * The header at the start of every B+tree node page.
+ * Keys are counted here, so any int (including 0) can be a key.
+ * The keys of a node follow the header in one contiguous array, and the
+ * rids (or child pointers) come after all the keys, so a key search
+ * touches only the keys. Leaves link to their neighbors on both sides.
+ */
+typedef struct {
+	short type;     // LEAF_NODE or NONLEAF_NODE
+	short version;  // the layout version the node was written in
+	short keyCount; // # keys in the node
+	short level;    // 0 for a leaf, 1 for its parent, and so on
+	PageId sibling; // the next leaf to the right, or RC_END_OF_TREE
+	PageId prev;    // the next leaf to the left, or RC_END_OF_TREE
+} NodeHeader;
+
+const short LEAF_NODE = 1;
+const short NONLEAF_NODE = 2;
+const short PACKED_LEAF_NODE = 3;
+const short POSTING_NODE = 4;
+const short STRING_LEAF_NODE = 5;
+const short STRING_NONLEAF_NODE = 6;
+const short COUNTED_NONLEAF_NODE = 7;
+const short NODE_VERSION = 1;
+
+/**
+ * A key that appears more than once keeps a short run of entries next to
+ * each other in one leaf, one per RecordId in insertion order. A leaf
+ * entry whose rid has this sid holds a key whose run outgrew the leaf.
+ * Its RecordIds are in a posting list whose first page is rid.pid.
+ */
+const int POSTING_SID = -1;
+
+/**
+ * A packed leaf (PACKED_LEAF_NODE) follows its NodeHeader with this header.
+ * Its keys and pids are stored as offsets from the smallest one in the node,
+ * each in the fewest bytes (1, 2 or 4) that hold the largest offset, and
+ * so are the sids. The keys come first, then the pids, then the sids.
+ */
+typedef struct {
+	int baseKey;    // the smallest key in the node
+	PageId basePid; // the smallest pid in the node
+	char keyBytes;  // bytes per stored key
+	char pidBytes;  // bytes per stored pid
+	char sidBytes;  // bytes per stored sid
+	char unused;
+} PackedHeader;
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
  */
 class BTLeafNode {
   public:
-	BTLeafNode();
+	BTLeafNode(int pageSize = PageFile::PAGE_SIZE);
+	BTLeafNode(const BTLeafNode& other);
+	~BTLeafNode();
+	BTLeafNode& operator=(const BTLeafNode& other);
 	RC initBuffer();
 	RC printBuffer();
+
+   /**
+    * Switch the node between the plain and the packed leaf format,
+    * keeping its entries. A sibling split off a node keeps its format.
+    * @param packed[IN] true for the packed format
+    * @return 0 if successful. Return an error code if the entries do not fit.
+    */
+    RC setPacked(bool packed);
+
+   /**
+    * Return whether the node is in the packed leaf format.
+    * @return true if the node is packed
+    */
+    bool isPacked();
   
    /**
-    * Insert the (key, rid) pair to the node.
+    * Insert the (key, rid) pair to the node, behind any equal keys.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param rid[IN] the RecordId to insert
@@ -34,12 +101,14 @@ class BTLeafNode {
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
-    * The first key of the sibling node is returned in siblingKey.
+    * The last key left in this node is returned in siblingKey; it goes
+    * to the parent as the separator, which sends equal keys to the left.
+    * The split moves off the middle so as not to cut a run of equal keys.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert.
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
-    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @param siblingKey[OUT] the largest key in this node after split.
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
@@ -51,7 +120,8 @@ class BTLeafNode {
     * @param searchKey[IN] the key to search for.
     * @param eid[OUT] the entry number that contains a key larger              
     *                 than or equalty to searchKey.
-    * @return 0 if successful. Return an error code if there is an error.
+    * @return 0 if successful. Return 1 (with eid set to getKeyCount())
+    *         if every key in the node is smaller than searchKey.
     */
     RC locate(int searchKey, int& eid);
 
@@ -64,6 +134,22 @@ class BTLeafNode {
     */
     RC readEntry(int eid, int& key, RecordId& rid);
 
+   /**
+    * Replace the rid of the eid entry, keeping its key.
+    * @param eid[IN] the entry number to change
+    * @param rid[IN] the new RecordId of the entry
+    * @return 0 if successful. Return RC_NODE_FULL (leaving the node as it
+    *         was) if a packed node cannot hold the new rid.
+    */
+    RC replaceEntry(int eid, const RecordId& rid);
+
+   /**
+    * Remove the eid entry from the node.
+    * @param eid[IN] the entry number to remove
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC removeEntry(int eid);
+
    /**
     * Return the pid of the next slibling node.
     * @return the PageId of the next sibling node 
@@ -78,14 +164,42 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous slibling node.
+    * @return the PageId of the previous sibling node 
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous slibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node 
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
     */
     int getKeyCount();
+
+   /**
+    * Return the number of keys the node can hold.
+    * A packed node may fill up before that when its keys spread out.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
+   /**
+    * Return the longest run of entries with one key the node keeps.
+    * A split can always leave such a run whole on one side.
+    * @return the longest run
+    */
+    int getMaxRunLength();
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node takes the page size of pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -94,23 +208,84 @@ class BTLeafNode {
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * The page size of pf must be the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC write(PageId pid, PageFile& pf);
 
+   /**
+    * Pin the page pid in the PageFile pf and use the cached frame as the
+    * content of the node, without copying it into the node's own buffer.
+    * The node is read-only while pinned; use read() to modify a node.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(). Nothing happens if no page is pinned.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC unpin();
+
    private:
+   /**
+    * The content of the node. Points to page when the node was read,
+    * or to the pinned frame in the PageFile cache when it was pinned.
+    */
+    char* buffer;
+
    /**
     * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * that contains the node, pageSize bytes long.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char* page;
+    int pageSize;
+
+   /**
+    * Change the page size of the node, reallocating page if needed.
+    * @param size[IN] the new page size
+    */
+    void setPageSize(int size);
+
+    const PageFile* pinnedFile; // the PageFile of the pinned page, if any
+    PageId pinnedPid;           // the PageId of the pinned page
     
-    typedef struct {
-		int key;
-		RecordId rid;
-	} Entry;
+	// Plain format: the header, then plainCapacity() keys, then as many rids
+	NodeHeader* header() { return (NodeHeader*) buffer; }
+	int* keys() { return (int*) (buffer+sizeof(NodeHeader)); }
+	RecordId* rids() { return (RecordId*) (keys()+plainCapacity()); }
+	int plainCapacity() { return (pageSize-sizeof(NodeHeader))/(sizeof(int)+sizeof(RecordId)); }
+
+	// Packed format: the header, the PackedHeader, then the packed entries
+	PackedHeader* packedHeader() { return (PackedHeader*) (buffer+sizeof(NodeHeader)); }
+	char* packedData() { return buffer+sizeof(NodeHeader)+sizeof(PackedHeader); }
+
+   /**
+    * Decode every entry of the node, whatever its format.
+    * @param key[OUT] the keys of the node
+    * @param rid[OUT] the RecordIds of the node
+    */
+    void unpack(std::vector<int>& key, std::vector<RecordId>& rid);
+
+   /**
+    * Replace the entries of the node with entries [from, to) of key and rid,
+    * encoded in the format of the node.
+    * @param key[IN] sorted keys
+    * @param rid[IN] the RecordIds that go with the keys
+    * @return 0 if successful. Return RC_NODE_FULL (leaving the node as it
+    *         was) if the entries do not fit.
+    */
+    RC pack(const std::vector<int>& key, const std::vector<RecordId>& rid, int from, int to);
+
+   /**
+    * Check that the page in the node buffer is a leaf node.
+    * @return 0 if successful. Return an error code if the page is not a leaf.
+    */
+    RC checkVersion();
 }; 
 
 
@@ -119,16 +294,20 @@ class BTLeafNode {
  */
 class BTNonLeafNode {
   public:
-    BTNonLeafNode();
+    BTNonLeafNode(int pageSize = PageFile::PAGE_SIZE);
+    BTNonLeafNode(const BTNonLeafNode& other);
+    ~BTNonLeafNode();
+    BTNonLeafNode& operator=(const BTNonLeafNode& other);
 	RC initBuffer();
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the # RecordIds under pid, kept by a counted node
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, int count = 0);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -140,13 +319,16 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param count[IN] the # RecordIds under pid, kept by a counted node
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int count = 0);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
-    * output it in pid.
+    * output it in pid. When searchKey equals a key in the node, the
+    * child to the left of the key is followed: a key in a nonleaf node
+    * is the largest key under the child on its left.
     * Remember that the keys inside a B+tree node are sorted.
     * @param searchKey[IN] the searchKey that is being looked up.
     * @param pid[OUT] the pointer to the child node to follow.
@@ -154,6 +336,16 @@ class BTNonLeafNode {
     */
     RC locateChildPtr(int searchKey, PageId& pid);
 
+   /**
+    * Find the child-node pointer to follow as locateChildPtr() does,
+    * and also output its position in the node.
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param pid[OUT] the pointer to the child node to follow.
+    * @param eid[OUT] the position of the pointer, 0 for the leading one.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtr(int searchKey, PageId& pid, int& eid);
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
@@ -169,8 +361,67 @@ class BTNonLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the number of keys the node can hold.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
+   /**
+    * Return the level of the node, 1 for the parents of the leaves.
+    * @return the level of the node
+    */
+    int getLevel();
+
+   /**
+    * Set the level of the node.
+    * @param level[IN] the level of the node, 1 for the parents of the leaves
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLevel(int level);
+
+   /**
+    * Switch the node between the plain and the counted format, keeping
+    * its keys and pointers. A counted node (COUNTED_NONLEAF_NODE) also
+    * keeps the # RecordIds under each of its pointers, which start at 0,
+    * and holds about a third fewer keys.
+    * @param counted[IN] true for the counted format
+    * @return 0 if successful. Return an error code if the entries do not fit.
+    */
+    RC setCounted(bool counted);
+
+   /**
+    * Return whether the node is in the counted format.
+    * @return true if the node keeps counts
+    */
+    bool isCounted();
+
+   /**
+    * Return the # RecordIds under a pointer of a counted node.
+    * @param eid[IN] the position of the pointer, 0 for the leading one
+    * @return the count, 0 if the node is not counted
+    */
+    int getChildCount(int eid);
+
+   /**
+    * Set the # RecordIds under a pointer of a counted node.
+    * @param eid[IN] the position of the pointer, 0 for the leading one
+    * @param count[IN] the count
+    * @return 0 if successful. Return an error code if the node is not counted.
+    */
+    RC setChildCount(int eid, int count);
+
+   /**
+    * Return the # RecordIds under the pointers before position eid
+    * of a counted node; getKeyCount()+1 gives the whole node.
+    * @param eid[IN] the position of the first pointer not counted
+    * @return the count, 0 if the node is not counted
+    */
+    int countBefore(int eid);
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node takes the page size of pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -179,23 +430,442 @@ class BTNonLeafNode {
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * The page size of pf must be the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC write(PageId pid, PageFile& pf);
 
+   /**
+    * Pin the page pid in the PageFile pf and use the cached frame as the
+    * content of the node, without copying it into the node's own buffer.
+    * The node is read-only while pinned; use read() to modify a node.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(). Nothing happens if no page is pinned.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC unpin();
+
   private:
+   /**
+    * The content of the node. Points to page when the node was read,
+    * or to the pinned frame in the PageFile cache when it was pinned.
+    */
+    char* buffer;
+
    /**
     * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * that contains the node, pageSize bytes long.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char* page;
+    int pageSize;
+
+   /**
+    * Change the page size of the node, reallocating page if needed.
+    * @param size[IN] the new page size
+    */
+    void setPageSize(int size);
+
+    const PageFile* pinnedFile; // the PageFile of the pinned page, if any
+    PageId pinnedPid;           // the PageId of the pinned page
     
-    typedef struct {
-		int key;
-		PageId pid;
-	} Entry;
+	// The header, then getMaxKeyCount() keys, then one more child pointers,
+	// and in a counted node one count per pointer.
+	// Pointer 0 leads to the keys <= key 0, pointer i+1 to the keys > key i.
+	NodeHeader* header() { return (NodeHeader*) buffer; }
+	int* keys() { return (int*) (buffer+sizeof(NodeHeader)); }
+	PageId* pids() { return (PageId*) (keys()+getMaxKeyCount()); }
+	int* counts() { return (int*) (pids()+getMaxKeyCount()+1); }
+
+   /**
+    * Check that the page in the node buffer is a nonleaf node.
+    * @return 0 if successful. Return an error code if the page is not a nonleaf.
+    */
+    RC checkVersion();
 }; 
 
+/**
+ * BTPostingNode: a page of a posting list, the RecordIds of a key that
+ * appears too often for a run in its leaf. The pages of a list are chained
+ * through their next pointers in the order the RecordIds were added.
+ * The first page also keeps the last page and the length of the list.
+ */
+class BTPostingNode {
+  public:
+	BTPostingNode(int pageSize = PageFile::PAGE_SIZE);
+	~BTPostingNode();
+	RC initBuffer();
+
+   /**
+    * Add rid at the end of the page.
+    * @param rid[IN] the RecordId to add
+    * @return 0 if successful. Return RC_NODE_FULL if the page is full.
+    */
+    RC append(const RecordId& rid);
+
+   /**
+    * Read the eid-th RecordId of the page.
+    * @param eid[IN] the entry number to read
+    * @param rid[OUT] the RecordId in the entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, RecordId& rid);
+
+   /**
+    * Return the number of RecordIds in the page.
+    * @return the number of RecordIds in the page
+    */
+    int getCount();
+
+   /**
+    * Return the number of RecordIds the page can hold.
+    * @return the capacity of the page
+    */
+    int getMaxCount();
+
+   /**
+    * Return the pid of the next page of the list.
+    * @return the PageId of the next page, RC_END_OF_TREE on the last page
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the pid of the next page of the list.
+    * @param pid[IN] the PageId of the next page
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+
+   /**
+    * Return the pid of the last page of the list (first page only).
+    * @return the PageId of the last page
+    */
+    PageId getLastNodePtr();
+
+   /**
+    * Set the pid of the last page of the list (first page only).
+    * @param pid[IN] the PageId of the last page
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLastNodePtr(PageId pid);
+
+   /**
+    * Return the number of RecordIds in the whole list (first page only).
+    * @return the length of the list
+    */
+    int getTotalCount();
+
+   /**
+    * Set the number of RecordIds in the whole list (first page only).
+    * @param count[IN] the length of the list
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setTotalCount(int count);
+
+   /**
+    * Read the content of the page from the page pid in the PageFile pf.
+    * The node takes the page size of pf.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the page to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Pin the page pid in the PageFile pf and use the cached frame as the
+    * content of the node, without copying it. The node is read-only
+    * while pinned. The frame is released by unpin() or the destructor.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(). Nothing happens if no page is pinned.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC unpin();
+
+  private:
+	// Not copyable
+	BTPostingNode(const BTPostingNode& other);
+	BTPostingNode& operator=(const BTPostingNode& other);
+
+    char* buffer;               // page, or the pinned frame
+    char* page;                 // the node's own pageSize bytes
+    int pageSize;
+    void setPageSize(int size);
+
+    const PageFile* pinnedFile; // the PageFile of the pinned page, if any
+    PageId pinnedPid;           // the PageId of the pinned page
+
+	typedef struct {
+		PageId last; // the last page of the list
+		int total;   // # RecordIds in the list
+	} PostingHeader;
+
+	// The header, the PostingHeader, then the RecordIds
+	NodeHeader* header() { return (NodeHeader*) buffer; }
+	PostingHeader* postingHeader() { return (PostingHeader*) (buffer+sizeof(NodeHeader)); }
+	RecordId* rids() { return (RecordId*) (buffer+sizeof(NodeHeader)+sizeof(PostingHeader)); }
+
+   /**
+    * Check that the page in the node buffer is a posting page.
+    * @return 0 if successful. Return an error code if the page is not a posting page.
+    */
+    RC checkVersion();
+};
+
+/**
+ * BTStringNode: a B+tree node keyed by strings, for the index on the value
+ * column. Entries are ordered by (string, rid), so every entry is unique
+ * even when strings repeat. The node is slotted: fixed-size slots follow
+ * the header in key order, and the string bytes they point to fill the
+ * page from its end.
+ * A leaf entry holds a RecordId. A nonleaf entry holds a separator
+ * (a string and a rid) and the child with the keys >= the separator;
+ * the child with the keys below the first separator is kept apart.
+ */
+class BTStringNode {
+  public:
+   /**
+    * Create an empty node.
+    * @param type[IN] STRING_LEAF_NODE or STRING_NONLEAF_NODE
+    * @param pageSize[IN] the page size of the node
+    */
+	BTStringNode(short type = STRING_LEAF_NODE, int pageSize = PageFile::PAGE_SIZE);
+	~BTStringNode();
+	RC initBuffer();
+
+   /**
+    * Return whether the node is a leaf.
+    * @return true for a leaf
+    */
+    bool isLeaf();
+
+   /**
+    * Return the number of entries in the node.
+    * @return the number of entries
+    */
+    int getKeyCount();
+
+   /**
+    * Return the level of the node, 0 for a leaf.
+    * @return the level of the node
+    */
+    int getLevel();
+
+   /**
+    * Set the level of the node.
+    * @param level[IN] the level of the node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLevel(int level);
+
+   /**
+    * Insert an entry to the node, keeping the entries sorted.
+    * In a leaf rid is the RecordId of the entry. In a nonleaf (key, rid)
+    * is a separator and pid the child with the keys >= the separator.
+    * @param key[IN] the string of the entry
+    * @param rid[IN] the rid of the entry
+    * @param pid[IN] the child of a nonleaf entry
+    * @return 0 if successful. Return RC_NODE_FULL if the node is full.
+    */
+    RC insert(const std::string& key, const RecordId& rid, PageId pid = -1);
+
+   /**
+    * Insert an entry to the node and split the node with sibling,
+    * about half of the bytes going to each.
+    * A leaf returns a separator between the two nodes, as short as it
+    * can be. A nonleaf moves its middle separator up, and its child
+    * becomes the first child of sibling.
+    * @param key[IN] the string of the entry
+    * @param rid[IN] the rid of the entry
+    * @param pid[IN] the child of a nonleaf entry
+    * @param sibling[IN] the sibling node to split with. It MUST be empty.
+    * @param midKey[OUT] the string of the separator for the parent
+    * @param midRid[OUT] the rid of the separator for the parent
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC insertAndSplit(const std::string& key, const RecordId& rid, PageId pid,
+                      BTStringNode& sibling, std::string& midKey, RecordId& midRid);
+
+   /**
+    * Find the first leaf entry larger than or equal to (searchKey, rid).
+    * @param searchKey[IN] the string to search for
+    * @param rid[IN] the rid to search for
+    * @param eid[OUT] the entry number, getKeyCount() if there is none
+    * @return 0 if successful. Return 1 if every entry is smaller.
+    */
+    RC locate(const std::string& searchKey, const RecordId& rid, int& eid);
+
+   /**
+    * Find the child of a nonleaf to follow for (searchKey, rid).
+    * @param searchKey[IN] the string to search for
+    * @param rid[IN] the rid to search for
+    * @param pid[OUT] the child to follow
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtr(const std::string& searchKey, const RecordId& rid, PageId& pid);
+
+   /**
+    * Read the eid entry.
+    * @param eid[IN] the entry number to read
+    * @param key[OUT] the string of the entry
+    * @param rid[OUT] the rid of the entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, std::string& key, RecordId& rid);
+
+   /**
+    * Initialize a nonleaf root with (pid1, separator, pid2).
+    * @param pid1[IN] the child with the keys below the separator
+    * @param key[IN] the string of the separator
+    * @param rid[IN] the rid of the separator
+    * @param pid2[IN] the child with the keys >= the separator
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC initializeRoot(PageId pid1, const std::string& key, const RecordId& rid, PageId pid2);
+
+   /**
+    * Set the child of a nonleaf with the keys below its first separator.
+    * @param pid[IN] the PageId of the child
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setFirstChildPtr(PageId pid);
+
+   /**
+    * Return the number of bytes not used by the slots and strings.
+    * @return the free space of the node
+    */
+    int getFreeSpace();
+
+   /**
+    * Pick a separator between two adjacent leaf entries: the shortest
+    * prefix of the right string that is above the left one, or the whole
+    * right entry if the strings match.
+    * @param leftKey[IN] the string of the left entry
+    * @param rightKey[IN] the string of the right entry
+    * @param rightRid[IN] the rid of the right entry
+    * @param midKey[OUT] the string of the separator
+    * @param midRid[OUT] the rid of the separator
+    */
+    static void separator(const std::string& leftKey, const std::string& rightKey,
+                          const RecordId& rightRid, std::string& midKey, RecordId& midRid);
+
+   /**
+    * Return the pid of the next leaf.
+    * @return the PageId of the next leaf, RC_END_OF_TREE on the last one
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the pid of the next leaf.
+    * @param pid[IN] the PageId of the next leaf
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+
+   /**
+    * Read the content of the node from the page pid in the PageFile pf.
+    * The node takes the page size and the type of the page.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the node to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Pin the page pid in the PageFile pf and use the cached frame as the
+    * content of the node, without copying it. The node is read-only
+    * while pinned. The frame is released by unpin() or the destructor.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(). Nothing happens if no page is pinned.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC unpin();
+
+  private:
+	// Not copyable
+	BTStringNode(const BTStringNode& other);
+	BTStringNode& operator=(const BTStringNode& other);
+
+    char* buffer;               // page, or the pinned frame
+    char* page;                 // the node's own pageSize bytes
+    int pageSize;
+    short type;                 // the type of a new node
+    void setPageSize(int size);
+
+    const PageFile* pinnedFile; // the PageFile of the pinned page, if any
+    PageId pinnedPid;           // the PageId of the pinned page
+
+	typedef struct {
+		int heapUsed;      // # bytes of strings at the end of the page
+		PageId firstChild; // nonleaf: the child below the first separator
+	} StringHeader;
+
+	// A slot; a nonleaf slot is followed by the child PageId.
+	// The string is the length bytes that end `end` bytes before the end
+	// of the page.
+	typedef struct {
+		unsigned short end;
+		unsigned short length;
+		RecordId rid;
+	} Slot;
+
+	NodeHeader* header() { return (NodeHeader*) buffer; }
+	StringHeader* stringHeader() { return (StringHeader*) (buffer+sizeof(NodeHeader)); }
+	int slotSize() { return isLeaf() ? sizeof(Slot) : sizeof(Slot)+sizeof(PageId); }
+	Slot* slot(int eid) { return (Slot*) (buffer+sizeof(NodeHeader)+sizeof(StringHeader)+eid*slotSize()); }
+	PageId* child(int eid) { return (PageId*) (slot(eid)+1); }
+	const char* keyOf(Slot* s) { return buffer+pageSize-s->end; }
+
+	// Compare entry eid with (key, rid), like strcmp
+	int compare(int eid, const std::string& key, const RecordId& rid);
+
+	// Return the first entry larger than or equal to (key, rid)
+	int search(const std::string& key, const RecordId& rid);
+
+	// Decode all entries, and replace them with [from, to) of the vectors
+	void unpack(std::vector<std::string>& key, std::vector<RecordId>& rid, std::vector<PageId>& pid);
+	RC pack(const std::vector<std::string>& key, const std::vector<RecordId>& rid,
+	        const std::vector<PageId>& pid, int from, int to);
+
+   /**
+    * Check that the page in the node buffer is a string node.
+    * @return 0 if successful. Return an error code if the page is not a string node.
+    */
+    RC checkVersion();
+};
+
 #endif /* BTNODE_H */
@@ -26,5 +26,13 @@ const int RC_INVALID_CURSOR      = -1011;
 const int RC_NO_SUCH_RECORD      = -1012;
 const int RC_END_OF_TREE         = -1013;
 const int RC_INVALID_ATTRIBUTE   = -1014;
+const int RC_INVALID_CACHE_SIZE  = -1015;
+const int RC_CACHE_FULL          = -1016;
+const int RC_PAGE_NOT_PINNED     = -1017;
+const int RC_IO_BACKEND_FAILED   = -1018;
+const int RC_IO_QUEUE_FULL       = -1019;
+const int RC_INVALID_PAGE_SIZE   = -1020;
+const int RC_INVALID_FILL_FACTOR = -1021;
+const int RC_PAGE_PINNED         = -1022;
 
 #endif // BRUINBASE_H
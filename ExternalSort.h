@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <cstdio>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * sort a stream of fixed-size items that may not fit in memory.
+ * add() collects the items up to a memory budget. each full batch is
+ * sorted and written to a temporary file as a run. after finish(),
+ * next() returns the items in order, merging the runs if there are any.
+ * T must be ordered by operator< and copyable byte by byte.
+ */
+template<class T>
+class ExternalSort {
+ public:
+  static const size_t DEFAULT_MEMORY = 8 << 20;  // 8MB of items per run
+
+  /**
+   * @param memory[IN] the # bytes of items kept in memory at a time
+   */
+  ExternalSort(size_t memory = DEFAULT_MEMORY)
+  {
+    runLength = std::max((size_t) 1, memory / sizeof(T));
+    count = 0;
+    pos = 0;
+  }
+
+  ~ExternalSort()
+  {
+    for (unsigned i = 0; i < runs.size(); i++) fclose(runs[i]);
+  }
+
+  /**
+   * add an item to sort.
+   * @param item[IN] the item to add
+   * @return error code. 0 if no error
+   */
+  RC add(const T& item)
+  {
+    if (batch.empty()) batch.reserve(runLength);
+    batch.push_back(item);
+    count++;
+    return (batch.size() < runLength) ? 0 : spill();
+  }
+
+  /**
+   * sort the items added so far and get ready to return them.
+   * @return error code. 0 if no error
+   */
+  RC finish()
+  {
+    RC rc;
+    pos = 0;
+    if (runs.empty()) {
+      std::sort(batch.begin(), batch.end());
+      return 0;
+    }
+
+    // the last batch becomes a run too, then each run offers its first item
+    if (!batch.empty() && (rc = spill()) < 0) return rc;
+    for (unsigned i = 0; i < runs.size(); i++) {
+      rewind(runs[i]);
+      if ((rc = pull(i)) < 0) return rc;
+    }
+    return 0;
+  }
+
+  /**
+   * return the next item in order.
+   * @param item[OUT] the next item
+   * @return 0 if an item is returned, 1 after the last one, or an error code
+   */
+  RC next(T& item)
+  {
+    if (runs.empty()) {
+      if (pos >= batch.size()) return 1;
+      item = batch[pos++];
+      return 0;
+    }
+
+    if (heads.empty()) return 1;
+    Head h = heads.top();
+    heads.pop();
+    item = h.item;
+    return pull(h.run);
+  }
+
+  /**
+   * @return the # items added
+   */
+  size_t size() { return count; }
+
+ private:
+  typedef struct {
+    T   item;
+    int run;
+  } Head;
+
+  // orders the heap of run heads with the smallest item on top
+  struct Later {
+    bool operator()(const Head& a, const Head& b) const { return b.item < a.item; }
+  };
+
+  /**
+   * sort the batch and write it out as a run.
+   */
+  RC spill()
+  {
+    std::sort(batch.begin(), batch.end());
+    FILE* f = tmpfile();
+    if (f == NULL) return RC_FILE_OPEN_FAILED;
+    runs.push_back(f);
+    if (fwrite(&batch[0], sizeof(T), batch.size(), f) != batch.size()) return RC_FILE_WRITE_FAILED;
+    batch.clear();
+    return 0;
+  }
+
+  /**
+   * read the next item of a run into the heap, if the run has one.
+   */
+  RC pull(int run)
+  {
+    Head h;
+    h.run = run;
+    if (fread(&h.item, sizeof(T), 1, runs[run]) != 1) {
+      return ferror(runs[run]) ? RC_FILE_READ_FAILED : 0;
+    }
+    heads.push(h);
+    return 0;
+  }
+
+  size_t runLength;                // # items in a run
+  size_t count;                    // # items added
+  size_t pos;                      // the next item of batch to return
+  std::vector<T> batch;            // the items not written to a run yet
+  std::vector<FILE*> runs;         // the sorted runs on disk
+  std::priority_queue<Head, std::vector<Head>, Later> heads;  // the next item of each run
+};
+
+#endif // EXTERNALSORT_H
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "IoUring.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+IoUring::IoUring()
+{
+  ringFd = -1;
+  queued = inFlight = 0;
+  sqRing = cqRing = NULL;
+  sqes = NULL;
+  cqes = NULL;
+}
+
+IoUring::~IoUring()
+{
+  if (ringFd >= 0) close();
+}
+
+#ifdef HAVE_IO_URING
+
+//
+// the kernel and the ring owner update the queue indexes concurrently,
+// so they are read with acquire and written with release semantics
+//
+static unsigned loadAcquire(const unsigned* p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* p, unsigned v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int ringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+RC IoUring::open(unsigned entries)
+{
+  struct io_uring_params params;
+
+  if (ringFd >= 0) return RC_IO_BACKEND_FAILED;
+
+  memset(&params, 0, sizeof(params));
+  ringFd = (int) syscall(__NR_io_uring_setup, entries, &params);
+  if (ringFd < 0) { ringFd = -1; return RC_IO_BACKEND_FAILED; }
+
+  // map the submission queue, the submission entries and the completion queue
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  sqRing = ::mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  ringFd, IORING_OFF_SQ_RING);
+  cqRing = ::mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  ringFd, IORING_OFF_CQ_RING);
+  void* s = ::mmap(NULL, sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                   ringFd, IORING_OFF_SQES);
+  if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || s == MAP_FAILED) {
+    if (sqRing != MAP_FAILED) ::munmap(sqRing, sqRingSize);
+    if (cqRing != MAP_FAILED) ::munmap(cqRing, cqRingSize);
+    if (s != MAP_FAILED) ::munmap(s, sqesSize);
+    sqRing = cqRing = NULL;
+    ::close(ringFd);
+    ringFd = -1;
+    return RC_IO_BACKEND_FAILED;
+  }
+
+  char* sq = (char*) sqRing;
+  sqHead = (unsigned*) (sq + params.sq_off.head);
+  sqTail = (unsigned*) (sq + params.sq_off.tail);
+  sqMask = *(unsigned*) (sq + params.sq_off.ring_mask);
+  sqEntries = *(unsigned*) (sq + params.sq_off.ring_entries);
+  sqArray = (unsigned*) (sq + params.sq_off.array);
+  sqes = (struct io_uring_sqe*) s;
+
+  char* cq = (char*) cqRing;
+  cqHead = (unsigned*) (cq + params.cq_off.head);
+  cqTail = (unsigned*) (cq + params.cq_off.tail);
+  cqMask = *(unsigned*) (cq + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  queued = inFlight = 0;
+  return 0;
+}
+
+RC IoUring::close()
+{
+  unsigned long long tag;
+  int result;
+
+  if (ringFd < 0) return RC_IO_BACKEND_FAILED;
+
+  // the kernel may still write into the caller's buffers
+  while (pending() > 0) {
+    if (wait(tag, result) < 0) break;
+  }
+
+  ::munmap(sqes, sqesSize);
+  ::munmap(sqRing, sqRingSize);
+  ::munmap(cqRing, cqRingSize);
+  ::close(ringFd);
+
+  ringFd = -1;
+  sqRing = cqRing = NULL;
+  sqes = NULL;
+  cqes = NULL;
+  return 0;
+}
+
+RC IoUring::queueRead(int fd, void* buffer, size_t size, off_t offset, unsigned long long tag)
+{
+  if (ringFd < 0) return RC_IO_BACKEND_FAILED;
+
+  // only we advance the tail, but the kernel advances the head
+  unsigned tail = *sqTail;
+  if (tail - loadAcquire(sqHead) >= sqEntries) return RC_IO_QUEUE_FULL;
+
+  unsigned index = tail & sqMask;
+  struct io_uring_sqe* sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long long) (unsigned long) buffer;
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->user_data = tag;
+
+  sqArray[index] = index;
+  storeRelease(sqTail, tail + 1);
+  queued++;
+
+  return 0;
+}
+
+RC IoUring::submit()
+{
+  if (ringFd < 0) return RC_IO_BACKEND_FAILED;
+
+  while (queued > 0) {
+    int n = ringEnter(ringFd, queued, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_READ_FAILED;
+    }
+    queued -= n;
+    inFlight += n;
+  }
+  return 0;
+}
+
+RC IoUring::wait(unsigned long long& tag, int& result)
+{
+  RC rc;
+
+  if (ringFd < 0) return RC_IO_BACKEND_FAILED;
+  if ((rc = submit()) < 0) return rc;
+  if (inFlight == 0) return RC_IO_BACKEND_FAILED;
+
+  for (;;) {
+    // only we advance the head, but the kernel advances the tail
+    unsigned head = *cqHead;
+    if (head != loadAcquire(cqTail)) {
+      struct io_uring_cqe* cqe = &cqes[head & cqMask];
+      tag = cqe->user_data;
+      result = cqe->res;
+      storeRelease(cqHead, head + 1);
+      inFlight--;
+      return 0;
+    }
+
+    // nothing completed yet; sleep in the kernel until something does
+    if (ringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      return RC_FILE_READ_FAILED;
+    }
+  }
+}
+
+#else // !HAVE_IO_URING
+
+RC IoUring::open(unsigned entries)
+{
+  return RC_IO_BACKEND_FAILED;
+}
+
+RC IoUring::close()
+{
+  return RC_IO_BACKEND_FAILED;
+}
+
+RC IoUring::queueRead(int fd, void* buffer, size_t size, off_t offset, unsigned long long tag)
+{
+  return RC_IO_BACKEND_FAILED;
+}
+
+RC IoUring::submit()
+{
+  return RC_IO_BACKEND_FAILED;
+}
+
+RC IoUring::wait(unsigned long long& tag, int& result)
+{
+  return RC_IO_BACKEND_FAILED;
+}
+
+#endif // HAVE_IO_URING
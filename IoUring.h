@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <sys/types.h>
+#include "Bruinbase.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * a minimal io_uring submission/completion ring for asynchronous reads.
+ * reads are queued with queueRead(), handed to the kernel in one batch
+ * with submit(), and collected one at a time with wait().
+ * on systems without io_uring, open() fails and the caller is expected
+ * to fall back to blocking I/O.
+ */
+class IoUring {
+ public:
+  IoUring();
+  ~IoUring();
+
+  /**
+   * set up a ring that can hold the given # of queued reads.
+   * @param entries[IN] the size of the submission queue
+   * @return error code. 0 if no error
+   */
+  RC open(unsigned entries);
+
+  /**
+   * tear down the ring. reads in flight are waited for first.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return true if the ring is set up
+   */
+  bool isOpen() const { return ringFd >= 0; }
+
+  /**
+   * queue a read of size bytes at offset of fd into buffer.
+   * the read is not started until submit() is called.
+   * @param fd[IN] the file to read from
+   * @param buffer[IN] the memory to read into
+   * @param size[IN] the # of bytes to read
+   * @param offset[IN] the file offset to read from
+   * @param tag[IN] a value returned by wait() when the read completes
+   * @return error code. RC_IO_QUEUE_FULL if the submission queue is full
+   */
+  RC queueRead(int fd, void* buffer, size_t size, off_t offset, unsigned long long tag);
+
+  /**
+   * start all queued reads without waiting for them.
+   * @return error code. 0 if no error
+   */
+  RC submit();
+
+  /**
+   * wait until one of the submitted reads completes.
+   * queued reads are submitted first.
+   * @param tag[OUT] the tag given to queueRead()
+   * @param result[OUT] # bytes read, or -errno if the read failed
+   * @return error code. 0 if no error
+   */
+  RC wait(unsigned long long& tag, int& result);
+
+  /**
+   * @return the # of reads queued or submitted but not yet waited for
+   */
+  int pending() const { return queued + inFlight; }
+
+ private:
+  int       ringFd;       // file descriptor of the ring (-1 if not open)
+  unsigned  queued;       // # reads queued but not yet submitted
+  unsigned  inFlight;     // # reads submitted but not yet completed
+
+  // submission queue, shared with the kernel
+  void*     sqRing;
+  size_t    sqRingSize;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned  sqMask;
+  unsigned  sqEntries;
+  unsigned* sqArray;
+  struct io_uring_sqe* sqes;
+  size_t    sqesSize;
+
+  // completion queue, shared with the kernel
+  void*     cqRing;
+  size_t    cqRingSize;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned  cqMask;
+  struct io_uring_cqe* cqes;
+};
+
+#endif // IOURING_H
@@ -9,29 +9,129 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "IoUring.h"
+#include <cstring>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <vector>
 
 using std::string;
 
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+int PageFile::flushCount = 0;
+
+int PageFile::hitCount = 0;
+int PageFile::prefetchCount = 0;
+
+struct PageFile::cacheFrame* PageFile::cache = NULL;
+struct PageFile::ghostEntry* PageFile::ghosts = NULL;
+struct PageFile::cachePartition* PageFile::partitions = NULL;
+int   PageFile::cacheCount = 0;
+int   PageFile::partitionCount = 0;
+int*  PageFile::hashTable = NULL;
+int   PageFile::hashMask = 0;
+int*  PageFile::ghostTable = NULL;
+PageFile::CachePolicy PageFile::cachePolicy = PageFile::LRU;
+bool  PageFile::writeBack = true;
+int   PageFile::readAhead = PageFile::DEFAULT_READ_AHEAD;
+PageFile::IoBackend PageFile::ioBackend = PageFile::IO_SYNC;
+int   PageFile::defaultPageSize = PageFile::PAGE_SIZE;
+int   PageFile::pendingCount = 0;
+pthread_mutex_t PageFile::ioLatch = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t PageFile::configLatch = PTHREAD_MUTEX_INITIALIZER;
+PageFile::fileEntry* PageFile::openFiles = NULL;
+int   PageFile::nextFileId = 0;
+pthread_mutex_t PageFile::fileLatch = PTHREAD_MUTEX_INITIALIZER;
+
+// the io_uring shared by all files when the IO_URING backend is in use
+static IoUring ioRing;
+
+// the first page of a file starts with this header. files written before
+// page sizes could be chosen have no header and use PageFile::PAGE_SIZE.
+static const char FILE_MAGIC[8] = "BRUINPF";
+static const int  FILE_VERSION = 1;
+
+struct FileHeader {
+  char magic[8];        // FILE_MAGIC
+  int  version;         // FILE_VERSION
+  int  pageSize;        // the size of every page of the file, header included
+};
+
+// holds a latch for as long as it is in scope
+class LatchGuard {
+ public:
+  LatchGuard(pthread_mutex_t& m) : latch(m) { pthread_mutex_lock(&latch); }
+  ~LatchGuard() { pthread_mutex_unlock(&latch); }
+ private:
+  pthread_mutex_t& latch;
+};
+
+// check that a page size is a power of 2 in the supported range
+static bool validPageSize(int size)
+{
+  return size >= PageFile::MIN_PAGE_SIZE && size <= PageFile::MAX_PAGE_SIZE &&
+         (size & (size - 1)) == 0;
+}
+
+// add n to a counter that other threads may be updating
+static inline void bump(int& counter, int n)
+{
+  __sync_fetch_and_add(&counter, n);
+}
+
+// raise the end pid of a file to end, unless another thread got further
+static inline void raiseEnd(PageId& epid, PageId end)
+{
+  PageId old;
+  while ((old = epid) < end && !__sync_bool_compare_and_swap(&epid, old, end)) {}
+}
 
 PageFile::PageFile() 
 { 
   fd = -1; 
-  epid = 0; 
+  file = NULL; 
+  writable = false;
+  psize = PAGE_SIZE;
+  base = 0;
+  sequential = false;
+  lastPid = -1;
+  seqCount = 0;
+  aheadPid = 0;
+  map = NULL;
+  mapPages = 0;
+  mapPins = 0;
+  poolPins = 0;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
-  epid = 0;
+  file = NULL;
+  writable = false;
+  psize = PAGE_SIZE;
+  base = 0;
+  sequential = false;
+  lastPid = -1;
+  seqCount = 0;
+  aheadPid = 0;
+  map = NULL;
+  mapPages = 0;
+  mapPins = 0;
+  poolPins = 0;
   open(filename.c_str(), mode);
 }
 
+PageFile::~PageFile()
+{
+  // make sure no dirty page outlives the file descriptor
+  if (fd > 0) close();
+}
+
 RC PageFile::open(const string& filename, char mode)
 {
   RC   rc;
@@ -50,6 +150,10 @@ RC PageFile::open(const string& filename, char mode)
   case 'W':
     oflag = (O_RDWR|O_CREAT);
     break;
+  case 'm':
+  case 'M':
+    oflag = O_RDONLY;
+    break;
   default:
     return RC_INVALID_FILE_MODE;
   }
@@ -58,121 +162,1163 @@ RC PageFile::open(const string& filename, char mode)
   fd = ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
 
-  // get the size of the file to set the end pid
+  // find out the page size of the file
+  writable = (oflag != O_RDONLY);
+  if ((rc = readHeader()) < 0) { ::close(fd); fd = -1; writable = false; return rc; }
+
+  // share the entry of the file with the PageFiles that have it open
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+  {
+    LatchGuard guard(fileLatch);
+    for (file = openFiles; file != NULL; file = file->next) {
+      if (file->dev == statbuf.st_dev && file->ino == statbuf.st_ino) break;
+    }
+    if (file == NULL) {
+      file = new fileEntry;
+      file->dev = statbuf.st_dev;
+      file->ino = statbuf.st_ino;
+      file->id = nextFileId++;
+      file->opens = 0;
+      file->fd = -1;
+      file->epid = 0;
+      file->frames = -1;
+      pthread_mutex_init(&file->latch, NULL);
+      file->next = openFiles;
+      openFiles = file;
+    }
+    file->opens++;
+
+    // dirty pages are written back through a descriptor of their own,
+    // so that they can be flushed after the PageFile that wrote them closes
+    if (writable && file->fd < 0) file->fd = ::dup(fd);
+  }
+
+  // the pool may hold pages past the end of the disk file
+  raiseEnd(file->epid, (statbuf.st_size - base) / psize);
+  sequential = false;
+  lastPid = -1;
+  seqCount = 0;
+  aheadPid = 0;
+
+  // map the existing pages in 'm' mode, once the dirty pages that other
+  // PageFiles left in the pool are on disk
+  if (mode == 'm' || mode == 'M') {
+    map = (char*) MAP_FAILED;
+    mapPages = 0;
+    mapPins = 0;
+    poolPins = 0;
+    if ((rc = flush()) < 0 || (rc = remap()) < 0) { map = NULL; close(); return rc; }
+  }
 
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+  // the kernel may still be reading into frames of this file
+  completeAll();
+
+  // write out the dirty pages of the file
+  rc = flush();
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+  // the last PageFile to close the file evicts its cached pages and
+  // forgets its evicted pages, so that a reopened file starts afresh
+  bool last;
+  {
+    LatchGuard guard(fileLatch);
+    last = (--file->opens == 0);
+    if (last) {
+      fileEntry** link = &openFiles;
+      while (*link != file) link = &(*link)->next;
+      *link = file->next;
+    }
+  }
+  if (last) {
+    std::vector<std::pair<PageId, int> > frames;
+    framesOf(file, frames);
+    for (unsigned i = 0; i < frames.size(); i++) {
+      int frame = frames[i].second;
+      LatchGuard guard(partitions[cache[frame].part].latch);
+      if (cache[frame].file == file && cache[frame].pid == frames[i].first) evictFrame(frame);
     }
+    dropGhosts(file);
+    if (file->fd >= 0) ::close(file->fd);
+    pthread_mutex_destroy(&file->latch);
+    delete file;
   }
 
-  // set the fd and epid to the initial state
+  // close the file
+  if (::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
+  // drop the memory mapping
+  if (map != NULL) {
+    if (map != MAP_FAILED) ::munmap(map, (size_t) offsetOf(mapPages));
+    map = NULL;
+    mapPages = 0;
+    mapPins = 0;
+    poolPins = 0;
+  }
+
+  // set the fd and file to the initial state
   fd = -1; 
-  epid = 0;
-  return 0;
+  file = NULL;
+  writable = false;
+  psize = PAGE_SIZE;
+  base = 0;
+  return rc;
 }
 
-PageId PageFile::endPid() const 
+RC PageFile::flush()
 {
-  return epid;
+  RC rc = 0;
+  std::vector<std::pair<PageId, int> > dirty;  // (pid, frame) pairs
+
+  if (fd <= 0) return RC_FILE_WRITE_FAILED;
+
+  // collect the dirty pages of the file. they are pinned while they are
+  // written, so that no other thread evicts and flushes them meanwhile.
+  // a frame may have changed hands since the list was read.
+  std::vector<std::pair<PageId, int> > frames;
+  framesOf(file, frames);
+  for (unsigned i = 0; i < frames.size(); i++) {
+    int frame = frames[i].second;
+    LatchGuard guard(partitions[cache[frame].part].latch);
+    if (cache[frame].file == file && cache[frame].pid == frames[i].first && cache[frame].dirty) {
+      cache[frame].pinCount++;
+      dirty.push_back(frames[i]);
+    }
+  }
+
+  // write the dirty pages in page order so that the disk sees a sequential run
+  std::sort(dirty.begin(), dirty.end());
+
+  // write each run of consecutive pages with one system call
+  int run[MAX_IO_RUN];
+  unsigned version[MAX_IO_RUN];
+  for (unsigned i = 0; i < dirty.size(); ) {
+    int n = 0;
+    do {
+      run[n++] = dirty[i++].second;
+    } while (i < dirty.size() && n < MAX_IO_RUN &&
+             dirty[i].first == dirty[i - 1].first + 1);
+
+    // no latch is held during the write, so another thread may write a
+    // page meanwhile. a page whose version changed stays dirty.
+    for (int j = 0; j < n; j++) {
+      LatchGuard guard(partitions[cache[run[j]].part].latch);
+      version[j] = cache[run[j]].version;
+    }
+    RC err = flushRun(run, n);
+    if (err < 0) rc = err;
+
+    for (int j = 0; j < n; j++) {
+      LatchGuard guard(partitions[cache[run[j]].part].latch);
+      if (err == 0 && cache[run[j]].version == version[j]) cache[run[j]].dirty = false;
+      dropPin(run[j]);
+    }
+  }
+
+  return rc;
 }
 
-RC PageFile::seek(PageId pid) const
+PageId PageFile::endPid() const 
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  return file != NULL ? file->epid : 0;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
+  if (!writable) return RC_INVALID_FILE_MODE;
   if (pid < 0) return RC_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
+  // in write-back mode, just update the cached frame and mark it dirty.
+  // if no frame can be freed up, fall through and write to disk.
+  if (writeBack) {
+    LatchGuard guard(partitionOf(file, pid).latch);
+    int frame = findUnpinned(file, pid);
+    if (frame >= 0 || allocFrame(file, pid, psize, offsetOf(pid), frame) == 0) {
+      memcpy(cache[frame].buffer, buffer, psize);
+      cache[frame].dirty = true;
+      cache[frame].version++;
+      touchFrame(frame);
+      raiseEnd(file->epid, pid + 1);
+      return 0;
+    }
+  }
 
   // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  if (::pwrite(fd, buffer, psize, offsetOf(pid)) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
-    }
+  // if the page is in cache, refresh the cached copy once it is unpinned
+  {
+    LatchGuard guard(partitionOf(file, pid).latch);
+    int frame = findUnpinned(file, pid);
+    if (frame >= 0) refreshFrame(frame, buffer);
   }
 
   // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  raiseEnd(file->epid, pid + 1);
 
   // increase page write count
-  writeCount++;
+  bump(writeCount, 1);
 
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+RC PageFile::writePages(PageId pid, int count, const void* buffer)
 {
   RC rc;
+  const char* page = (const char*) buffer;
+
+  if (!writable) return RC_INVALID_FILE_MODE;
+  if (pid < 0 || count < 0) return RC_INVALID_PID;
+
+  // in write-back mode, the pages only go to the buffer pool.
+  // they are flushed in runs later.
+  if (writeBack) {
+    for (int i = 0; i < count; i++) {
+      if ((rc = write(pid + i, page + i * psize)) < 0) return rc;
+    }
+    return 0;
+  }
+
+  // write the whole run with a single system call
+  if (::pwrite(fd, buffer, (size_t) count * psize, offsetOf(pid)) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  // refresh the cached copies of the pages
+  for (int i = 0; i < count; i++) {
+    LatchGuard guard(partitionOf(file, pid + i).latch);
+    int frame = findUnpinned(file, pid + i);
+    if (frame >= 0) refreshFrame(frame, page + i * psize);
+  }
+
+  raiseEnd(file->epid, pid + count);
+  bump(writeCount, count);
+
+  return 0;
+}
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+RC PageFile::readPages(PageId pid, int count, void* buffer) const
+{
+  RC   rc;
+  int  frame;
+  char *page = (char*) buffer;
+
+  if (map != NULL && pid + count > file->epid) remap();
+  if (pid < 0 || count < 0 || pid + count > file->epid) return RC_INVALID_PID;
+
+  for (int i = 0; i < count; i++) {
+    readAheadFrom(pid + i);
+
+    const char* m = mapped(pid + i);
+    if (m != NULL) {
+      memcpy(page + i * psize, m, psize);
+      bump(hitCount, 1);
+      continue;
+    }
+
+    // a missing page is read together with the missing pages after it
+    int n = std::min(count - i, (int) MAX_IO_RUN);
+    if ((rc = fetch(pid + i, frame, n)) < 0) return rc;
+    memcpy(page + i * psize, cache[frame].buffer, psize);
+    releaseFrame(frame);
+  }
+
+  return 0;
+}
+
+RC PageFile::read(PageId pid, void* buffer) const
+{
+  RC  rc;
+  int frame;
+
+  readAheadFrom(pid);
+
+  // pages of a memory-mapped file come straight from the mapping
+  const char* m = mapped(pid);
+  if (m != NULL) {
+    memcpy(buffer, m, psize);
+    bump(hitCount, 1);
+    return 0;
+  }
+
+  // the frame stays pinned while it is copied
+  if ((rc = fetch(pid, frame)) < 0) return rc;
+  memcpy(buffer, cache[frame].buffer, psize);
+  releaseFrame(frame);
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, const char*& page) const
+{
+  RC  rc;
+  int frame;
+
+  readAheadFrom(pid);
+
+  // pinning a mapped page only has to keep the mapping in place
+  const char* m = mapped(pid);
+  if (m != NULL) {
+    page = m;
+    mapPins++;
+    bump(hitCount, 1);
+    return 0;
+  }
+
+  // fetch() hands the frame out pinned
+  if ((rc = fetch(pid, frame)) < 0) return rc;
+  page = cache[frame].buffer;
+  if (map != NULL) poolPins++;
+
+  return 0;
+}
+
+RC PageFile::unpin(PageId pid) const
+{
+  // a page inside the mapping was pinned there, as pin() checks the
+  // mapping first. its frame in the pool, if any, belongs to another
+  // PageFile of the same file
+  if (map != NULL && mapPins > 0 && pid < mapPages) {
+    mapPins--;
+    return 0;
+  }
+
+  if (file != NULL) {
+    LatchGuard guard(partitionOf(file, pid).latch);
+    int frame = findFrame(file, pid, false);
+    if (frame >= 0 && cache[frame].pending == PENDING_NONE && cache[frame].pinCount > 0) {
+      dropPin(frame);
+      if (map != NULL) poolPins--;
+      return 0;
+    }
+  }
+
+  return RC_PAGE_NOT_PINNED;
+}
+
+RC PageFile::queueRead(PageId pid) const
+{
+  RC  rc;
+  int frame;
+
+  if (pid < 0 || pid >= file->epid) return RC_INVALID_PID;
+
+  // nothing to do if the page is already in memory
+  if (mapped(pid) != NULL) return 0;
+
+  if (ioBackend == IO_SYNC) {
+    {
+      LatchGuard guard(partitionOf(file, pid).latch);
+      if (findFrame(file, pid, false) >= 0) return 0;
+    }
+    if ((rc = fetch(pid, frame)) < 0) return rc;
+    releaseFrame(frame);
+    return 0;
+  }
+
+  // reserve a frame for the page. it stays pinned until the read is done,
+  // and other threads asking for the page wait for it.
+  // the frame is queued before the partition latch is let go, so that
+  // whoever finds it pending can reap its read with completeAll().
+  LatchGuard guard(partitionOf(file, pid).latch);
+  if (findFrame(file, pid, false) >= 0) return 0;
+  if ((rc = allocFrame(file, pid, psize, offsetOf(pid), frame)) < 0) return rc;
+
+  pthread_mutex_lock(&ioLatch);
+  rc = ioRing.queueRead(fd, cache[frame].buffer, psize,
+                        offsetOf(pid), frame);
+  if (rc == RC_IO_QUEUE_FULL) {
+    // the submission queue is full. hand it to the kernel and try again.
+    ioRing.submit();
+    rc = ioRing.queueRead(fd, cache[frame].buffer, psize,
+                          offsetOf(pid), frame);
+  }
+  if (rc == 0) pendingCount++;
+  pthread_mutex_unlock(&ioLatch);
+
+  if (rc < 0) {
+    evictFrame(frame);
+    return rc;
+  }
+
+  cache[frame].pinCount++;
+  cache[frame].pending = PENDING_ASYNC;
+
+  return 0;
+}
+
+RC PageFile::submitReads() const
+{
+  if (ioBackend == IO_SYNC) return 0;
+
+  LatchGuard guard(ioLatch);
+  return ioRing.submit();
+}
+
+RC PageFile::completeReads() const
+{
+  return completeAll();
+}
+
+RC PageFile::completeAll()
+{
+  RC rc = 0;
+  unsigned long long tag;
+  int result;
+
+  for (;;) {
+    // take one completion off the ring, then fill its frame under the
+    // partition latch. the two latches are never held at the same time.
+    pthread_mutex_lock(&ioLatch);
+    if (pendingCount == 0) {
+      pthread_mutex_unlock(&ioLatch);
+      break;
+    }
+    RC err = ioRing.wait(tag, result);
+    if (err == 0) pendingCount--;
+    pthread_mutex_unlock(&ioLatch);
+    if (err < 0) return err;
+
+    int frame = (int) tag;
+    cachePartition& part = partitions[cache[frame].part];
+    LatchGuard guard(part.latch);
+    cache[frame].pending = PENDING_NONE;
+    dropPin(frame);
+
+    if (result < 0) {
+      // a failed read leaves nothing worth keeping in the frame
+      evictFrame(frame);
+      rc = RC_FILE_READ_FAILED;
+    } else {
+      // the part of a page past the end of the disk file reads as zeros
+      int size = cache[frame].size;
+      if (result < size) memset(cache[frame].buffer + result, 0, size - result);
+      bump(readCount, 1);
+    }
+    pthread_cond_broadcast(&part.filled);
+  }
+
+  return rc;
+}
+
+RC PageFile::setSequential(bool on)
+{
+  if (fd <= 0) return RC_FILE_READ_FAILED;
+
+  // also let the kernel use its own, larger read-ahead window
+  sequential = on;
+  ::posix_fadvise(fd, 0, 0, on ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+  return 0;
+}
+
+void PageFile::readAheadFrom(PageId pid) const
+{
+  // several requests for the same page (e.g., one per record) count once
+  if (pid == lastPid) return;
+  seqCount = (pid == lastPid + 1) ? seqCount + 1 : 1;
+  lastPid = pid;
+
+  if (readAhead <= 0) return;
+  if (!sequential && seqCount < READ_AHEAD_TRIGGER) return;
+
+  // keep the prefetched window readAhead pages ahead of the reader.
+  // refill it when half of it has been consumed, so that the kernel
+  // gets requests large enough to be worth it.
+  PageId end = pid + 1 + readAhead;
+  PageId epid = file->epid;
+  if (end > epid) end = epid;
+  if (aheadPid < pid + 1) aheadPid = pid + 1;
+  if (end - aheadPid < readAhead / 2 && end < epid) return;
+  if (aheadPid >= end) return;
+
+  // POSIX_FADV_WILLNEED starts the reads and returns without waiting
+  ::posix_fadvise(fd, offsetOf(aheadPid),
+                  (off_t) (end - aheadPid) * psize, POSIX_FADV_WILLNEED);
+  bump(prefetchCount, end - aheadPid);
+  aheadPid = end;
+}
+
+const char* PageFile::mapped(PageId pid) const
+{
+  if (map == NULL || pid < 0) return NULL;
+  if (pid >= mapPages) remap();
+  if (pid >= mapPages) return NULL;
+
+  return map + offsetOf(pid);
+}
+
+RC PageFile::remap() const
+{
+  struct stat statbuf;
+
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_READ_FAILED;
+  PageId pages = (statbuf.st_size - base) / psize;
+  raiseEnd(file->epid, pages);
+
+  // nothing new to map, or the old mapping is still in use. the mapping
+  // does not grow over pages pinned in the pool either, so that unpin()
+  // still finds them there
+  if (pages <= mapPages || mapPins > 0 || poolPins > 0) return 0;
+
+  // the header is mapped too, so that the mapping starts at offset 0
+  char* m = (char*) ::mmap(NULL, (size_t) offsetOf(pages), PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) return RC_FILE_OPEN_FAILED;
+
+  if (map != MAP_FAILED) ::munmap(map, (size_t) offsetOf(mapPages));
+  map = m;
+  mapPages = pages;
+
+  return 0;
+}
+
+RC PageFile::readHeader()
+{
+  struct stat statbuf;
+  FileHeader header;
+
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_OPEN_FAILED;
+
+  // a new file gets a header page with the default page size.
+  // the part of the page after the header is left as zeros.
+  if (statbuf.st_size == 0) {
+    psize = defaultPageSize;
+    base = 0;
+    if (!writable) return 0;
+
+    std::vector<char> page(psize, 0);
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = FILE_VERSION;
+    header.pageSize = psize;
+    memcpy(&page[0], &header, sizeof(header));
+    if (::pwrite(fd, &page[0], psize, 0) < 0) return RC_FILE_WRITE_FAILED;
+    bump(writeCount, 1);
+
+    base = psize;
+    return 0;
+  }
+
+  // a file without the header is from before page sizes could be chosen
+  if (::pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+      memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0) {
+    psize = PAGE_SIZE;
+    base = 0;
+    return 0;
+  }
+
+  if (header.version != FILE_VERSION) return RC_INVALID_FILE_FORMAT;
+  if (!validPageSize(header.pageSize)) return RC_INVALID_PAGE_SIZE;
+  psize = header.pageSize;
+  base = psize;
+
+  return 0;
+}
+
+RC PageFile::fetch(PageId pid, int& frame, int count) const
+{
+  int frames[MAX_IO_RUN];
+  struct iovec iov[MAX_IO_RUN];
+
+  if (map != NULL && pid >= file->epid) remap();
+  if (pid < 0 || pid >= file->epid) return RC_INVALID_PID; 
 
   //
-  // if the page is in cache, read it from there
+  // if the page is in cache, use it from there.
+  // otherwise reserve a frame for it, so that other threads asking for
+  // the page wait for our read instead of reading it again.
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
-  }
-
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  {
+    RC rc;
+    LatchGuard guard(partitionOf(file, pid).latch);
+
+    frame = findFrame(file, pid);
+    if (frame >= 0) {
+      cache[frame].pinCount++;
+      touchFrame(frame);
+      bump(hitCount, 1);
+      return 0;
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+
+    if ((rc = allocFrame(file, pid, psize, offsetOf(pid), frame)) < 0) return rc;
+    cache[frame].pinCount++;
+    cache[frame].pending = PENDING_READ;
+  }
+  frames[0] = frame;
+
+  // reserve frames for the missing pages that follow as well.
+  // the run ends at the first page that is cached or being read: we must
+  // not wait for it, since its reader may be waiting for our pages.
+  // if a partition runs out of frames, the run is cut short there.
+  int n;
+  for (n = 1; n < count; n++) {
+    LatchGuard guard(partitionOf(file, pid + n).latch);
+    if (findFrame(file, pid + n, false) >= 0) break;
+    if (allocFrame(file, pid + n, psize, offsetOf(pid + n), frames[n]) < 0) break;
+    cache[frames[n]].pinCount++;
+    cache[frames[n]].pending = PENDING_READ;
+  }
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = cache[frames[i]].buffer;
+    iov[i].iov_len = psize;
+  }
+
+  // read the pages straight into the frames, with no latch held.
+  // the part of a page past the end of the disk file reads as zeros.
+  ssize_t size = ::preadv(fd, iov, n, offsetOf(pid));
+  ssize_t left = size;
+  for (int i = 0; i < n && size >= 0; i++, left -= psize) {
+    if (left < psize) {
+      memset(cache[frames[i]].buffer + (left > 0 ? left : 0), 0,
+             psize - (left > 0 ? left : 0));
     }
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+
+  // hand the pages to the threads waiting for them.
+  // only the first page stays pinned, for the caller.
+  for (int i = 0; i < n; i++) {
+    cachePartition& part = partitions[cache[frames[i]].part];
+    LatchGuard guard(part.latch);
+    cache[frames[i]].pending = PENDING_NONE;
+    if (size < 0) {
+      evictFrame(frames[i]);
+    } else if (i > 0) {
+      dropPin(frames[i]);
+    }
+    pthread_cond_broadcast(&part.filled);
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  if (size < 0) return RC_FILE_READ_FAILED;
 
   // increase the page read count
-  readCount++;
+  bump(readCount, n);
+
+  return 0;
+}
+
+RC PageFile::setCacheSize(int count)
+{
+  RC rc;
+
+  if (count <= 0) return RC_INVALID_CACHE_SIZE;
+  completeAll();
+  if ((rc = flushAll()) < 0) return rc;
+
+  // a pinned frame, or one still being read, cannot be freed
+  pthread_mutex_lock(&configLatch);
+  if (anyPinned()) {
+    pthread_mutex_unlock(&configLatch);
+    return RC_PAGE_PINNED;
+  }
+  freeCache();
+  cacheCount = count;
+  pthread_mutex_unlock(&configLatch);
+
+  // the frames of the open files went with the old pool
+  {
+    LatchGuard guard(fileLatch);
+    for (fileEntry* f = openFiles; f != NULL; f = f->next) f->frames = -1;
+  }
+  initCache();
+
+  return 0;
+}
+
+RC PageFile::setCachePolicy(CachePolicy policy)
+{
+  RC rc;
+
+  // the queues of the old policy stay in use if the pool cannot be rebuilt
+  CachePolicy old = cachePolicy;
+  cachePolicy = policy;
+  if ((rc = setCacheSize(getCacheSize())) < 0) cachePolicy = old;
+  return rc;
+}
+
+RC PageFile::setWriteBack(bool on)
+{
+  writeBack = on;
+  return on ? 0 : flushAll();
+}
+
+RC PageFile::setIoBackend(IoBackend backend)
+{
+  RC rc;
+
+  if (backend == ioBackend) return 0;
+
+  // let the reads in flight finish on the old backend
+  completeAll();
+
+  LatchGuard guard(ioLatch);
+  if (backend == IO_URING) {
+    if ((rc = ioRing.open(IO_RING_ENTRIES)) < 0) return rc;
+  } else {
+    ioRing.close();
+  }
+  ioBackend = backend;
+
+  return 0;
+}
+
+RC PageFile::setDefaultPageSize(int size)
+{
+  if (!validPageSize(size)) return RC_INVALID_PAGE_SIZE;
+  defaultPageSize = size;
+  return 0;
+}
+
+RC PageFile::setReadAhead(int pages)
+{
+  if (pages < 0) return RC_INVALID_CACHE_SIZE;
+  readAhead = pages;
+  return 0;
+}
+
+int PageFile::getCacheSize()
+{
+  if (__atomic_load_n(&partitions, __ATOMIC_ACQUIRE) == NULL) initCache();
+  return cacheCount;
+}
+
+void PageFile::initCache()
+{
+  LatchGuard guard(configLatch);
+
+  // another thread may have set up the pool while we waited
+  if (partitions != NULL) return;
+  if (cacheCount <= 0) cacheCount = DEFAULT_CACHE_COUNT;
+
+  // split the pool in as many partitions as it takes to keep threads
+  // apart, but keep the partitions big enough to hold their hot pages
+  partitionCount = 1;
+  while (partitionCount < MAX_PARTITIONS &&
+         cacheCount / (2 * partitionCount) >= MIN_PARTITION_FRAMES) {
+    partitionCount <<= 1;
+  }
+
+  // use at least two hash buckets per frame to keep the chains short.
+  // bucket b belongs to partition (b % partitionCount).
+  int buckets = 1;
+  while (buckets < 2 * cacheCount || buckets < partitionCount) buckets <<= 1;
+  hashMask = buckets - 1;
+  hashTable = new int[buckets];
+  ghostTable = new int[buckets];
+  for (int i = 0; i < buckets; i++) hashTable[i] = ghostTable[i] = -1;
+
+  // 2Q remembers as many evicted pages as half the pool (the paper's Kout)
+  cachePartition* parts = new cachePartition[partitionCount];
+  int ghostTotal = 0;
+  for (int p = 0; p < partitionCount; p++) {
+    cachePartition& part = parts[p];
+    pthread_mutex_init(&part.latch, NULL);
+    pthread_cond_init(&part.filled, NULL);
+    pthread_cond_init(&part.unpinned, NULL);
+    part.first = (int) ((long long) cacheCount * p / partitionCount);
+    part.count = (int) ((long long) cacheCount * (p + 1) / partitionCount) - part.first;
+    part.ghostFirst = ghostTotal;
+    part.ghostCount = part.count / 2 + 1;
+    part.ghostNext = 0;
+    ghostTotal += part.ghostCount;
+    for (int q = 0; q < QUEUE_COUNT; q++) {
+      part.queues[q].head = part.queues[q].tail = -1;
+      part.queues[q].size = 0;
+    }
+  }
+
+  ghosts = new ghostEntry[ghostTotal];
+  for (int i = 0; i < ghostTotal; i++) {
+    ghosts[i].file = NULL;
+    ghosts[i].pid = 0;
+    ghosts[i].hashNext = -1;
+  }
+
+  // every frame starts empty on the free queue of its partition.
+  // the queue is linked up here, since the pool is not published yet.
+  // the buffer of a frame is allocated when a page first needs it,
+  // since its size depends on the page size of the file.
+  cache = new cacheFrame[cacheCount];
+  for (int p = 0; p < partitionCount; p++) {
+    int first = parts[p].first;
+    int end = first + parts[p].count;
+    for (int i = first; i < end; i++) {
+      cache[i].file = NULL;
+      cache[i].pid = 0;
+      cache[i].part = p;
+      cache[i].size = 0;
+      cache[i].offset = 0;
+      cache[i].capacity = 0;
+      cache[i].pinCount = 0;
+      cache[i].dirty = false;
+      cache[i].version = 0;
+      cache[i].pending = PENDING_NONE;
+      cache[i].hashNext = -1;
+      cache[i].queue = QUEUE_FREE;
+      cache[i].lruPrev = (i + 1 < end) ? i + 1 : -1;
+      cache[i].lruNext = (i > first) ? i - 1 : -1;
+      cache[i].filePrev = cache[i].fileNext = -1;
+      cache[i].buffer = NULL;
+    }
+    cacheQueue& q = parts[p].queues[QUEUE_FREE];
+    q.head = end - 1;
+    q.tail = first;
+    q.size = parts[p].count;
+  }
+
+  // publish the pool only once it is complete
+  __atomic_store_n(&partitions, parts, __ATOMIC_RELEASE);
+}
+
+bool PageFile::anyPinned()
+{
+  // the caller holds configLatch
+  if (partitions == NULL) return false;
+  for (int p = 0; p < partitionCount; p++) {
+    cachePartition& part = partitions[p];
+    LatchGuard guard(part.latch);
+    for (int i = part.first; i < part.first + part.count; i++) {
+      if (cache[i].pinCount > 0 || cache[i].pending != PENDING_NONE) return true;
+    }
+  }
+  return false;
+}
+
+void PageFile::freeCache()
+{
+  for (int p = 0; p < partitionCount; p++) {
+    pthread_mutex_destroy(&partitions[p].latch);
+    pthread_cond_destroy(&partitions[p].filled);
+    pthread_cond_destroy(&partitions[p].unpinned);
+  }
+
+  for (int i = 0; i < cacheCount && cache != NULL; i++) delete [] cache[i].buffer;
+
+  delete [] partitions;
+  delete [] cache;
+  delete [] hashTable;
+  delete [] ghosts;
+  delete [] ghostTable;
+  partitions = NULL;
+  partitionCount = 0;
+  cache = NULL;
+  hashTable = NULL;
+  ghosts = NULL;
+  ghostTable = NULL;
+}
+
+int PageFile::hashOf(const fileEntry* file, PageId pid)
+{
+  unsigned h = (unsigned) pid * 2654435761u ^ (unsigned) file->id * 40503u;
+  return (int) ((h ^ (h >> 16)) & hashMask);
+}
+
+PageFile::cachePartition& PageFile::partitionOf(const fileEntry* file, PageId pid)
+{
+  if (__atomic_load_n(&partitions, __ATOMIC_ACQUIRE) == NULL) initCache();
+  return partitions[hashOf(file, pid) & (partitionCount - 1)];
+}
+
+int PageFile::findFrame(const fileEntry* file, PageId pid, bool wait)
+{
+  // the caller holds the latch of the page's partition
+  cachePartition& part = partitionOf(file, pid);
+
+  for (;;) {
+    int i;
+    for (i = hashTable[hashOf(file, pid)]; i >= 0; i = cache[i].hashNext) {
+      if (cache[i].file == file && cache[i].pid == pid) break;
+    }
+    if (i < 0 || !wait || cache[i].pending == PENDING_NONE) return i;
+
+    // the page is still being read. wait for it before handing it out,
+    // and look it up again, since a failed read gives up the frame.
+    if (cache[i].pending == PENDING_READ) {
+      pthread_cond_wait(&part.filled, &part.latch);
+    } else {
+      // nobody may be reaping io_uring reads, so reap them ourselves
+      pthread_mutex_unlock(&part.latch);
+      completeAll();
+      pthread_mutex_lock(&part.latch);
+    }
+  }
+}
+
+RC PageFile::allocFrame(fileEntry* file, PageId pid, int size, off_t offset, int& frame)
+{
+  RC rc;
+
+  // the caller holds the latch of the page's partition,
+  // and the frame comes from the same partition
+  cachePartition& part = partitionOf(file, pid);
+
+  frame = victimFrame(part);
+  if (frame < 0) return RC_CACHE_FULL;
+
+  // a dirty victim has to reach the disk before its frame is reused
+  if ((rc = flushFrame(frame)) < 0) return rc;
+  if (cache[frame].queue == QUEUE_A1) addGhost(cache[frame].file, cache[frame].pid);
+  evictFrame(frame);
+
+  // files with larger pages may have been using the pool so far
+  if (cache[frame].capacity < size) {
+    delete [] cache[frame].buffer;
+    cache[frame].buffer = new char[size];
+    cache[frame].capacity = size;
+  }
+
+  int bucket = hashOf(file, pid);
+  cache[frame].file = file;
+  cache[frame].pid = pid;
+  {
+    LatchGuard guard(file->latch);
+    cache[frame].filePrev = -1;
+    cache[frame].fileNext = file->frames;
+    if (file->frames >= 0) cache[file->frames].filePrev = frame;
+    file->frames = frame;
+  }
+  cache[frame].size = size;
+  cache[frame].offset = offset;
+  cache[frame].hashNext = hashTable[bucket];
+  hashTable[bucket] = frame;
+
+  // under 2Q a new page is on probation unless it was evicted from
+  // probation recently, which means it is requested more than once
+  if (cachePolicy == TWO_Q && !takeGhost(file, pid)) {
+    pushFrame(frame, QUEUE_A1);
+  } else {
+    pushFrame(frame, QUEUE_AM);
+  }
 
   return 0;
 }
+
+int PageFile::victimFrame(cachePartition& part)
+{
+  cacheQueue* queues = part.queues;
+
+  if (queues[QUEUE_FREE].size > 0) return queues[QUEUE_FREE].tail;
+
+  // 2Q evicts from probation while it holds more than a quarter of the
+  // partition (the paper's Kin), and from the main queue otherwise.
+  // pinned frames cannot be evicted, so skip over them.
+  int first = QUEUE_AM, second = QUEUE_A1;
+  if (queues[QUEUE_A1].size > part.count / 4) { first = QUEUE_A1; second = QUEUE_AM; }
+
+  for (int frame = queues[first].tail; frame >= 0; frame = cache[frame].lruPrev) {
+    if (cache[frame].pinCount == 0) return frame;
+  }
+  for (int frame = queues[second].tail; frame >= 0; frame = cache[frame].lruPrev) {
+    if (cache[frame].pinCount == 0) return frame;
+  }
+  return -1;
+}
+
+int PageFile::findUnpinned(const fileEntry* file, PageId pid)
+{
+  // the caller holds the latch of the page's partition.
+  // readers look at a pinned frame without the latch, so the frame must
+  // not be written into until the last of them lets go of it.
+  cachePartition& part = partitionOf(file, pid);
+  int frame;
+  while ((frame = findFrame(file, pid)) >= 0 && cache[frame].pinCount > 0) {
+    pthread_cond_wait(&part.unpinned, &part.latch);
+  }
+  return frame;
+}
+
+void PageFile::releaseFrame(int frame)
+{
+  LatchGuard guard(partitions[cache[frame].part].latch);
+  dropPin(frame);
+}
+
+void PageFile::dropPin(int frame)
+{
+  // the caller holds the latch of the frame's partition
+  if (--cache[frame].pinCount == 0) {
+    pthread_cond_broadcast(&partitions[cache[frame].part].unpinned);
+  }
+}
+
+void PageFile::refreshFrame(int frame, const void* buffer)
+{
+  // the caller holds the latch of the frame's partition, and nobody has
+  // the frame pinned. a dirty frame stays dirty: a flush of its older
+  // content may have reached the disk after ours.
+  memcpy(cache[frame].buffer, buffer, cache[frame].size);
+  cache[frame].version++;
+}
+
+RC PageFile::flushFrame(int frame)
+{
+  RC rc;
+
+  // the caller holds the latch of the frame's partition
+  if (cache[frame].file == NULL || !cache[frame].dirty) return 0;
+  if ((rc = flushRun(&frame, 1)) < 0) return rc;
+  cache[frame].dirty = false;
+  return 0;
+}
+
+RC PageFile::flushRun(const int* frames, int count)
+{
+  struct iovec iov[MAX_IO_RUN];
+
+  // the frames hold consecutive pages of one file, which may be any
+  // open file, so use the descriptor kept in its entry.
+  // the caller keeps the frames from being evicted, and clears their
+  // dirty flags if their version did not change during the write.
+  for (int i = 0; i < count; i++) {
+    iov[i].iov_base = cache[frames[i]].buffer;
+    iov[i].iov_len = cache[frames[i]].size;
+  }
+  if (::pwritev(cache[frames[0]].file->fd, iov, count, cache[frames[0]].offset) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  bump(writeCount, count);
+  bump(flushCount, count);
+
+  return 0;
+}
+
+RC PageFile::flushAll()
+{
+  RC rc = 0;
+
+  for (int p = 0; p < partitionCount; p++) {
+    LatchGuard guard(partitions[p].latch);
+    for (int i = partitions[p].first; i < partitions[p].first + partitions[p].count; i++) {
+      RC err = flushFrame(i);
+      if (err < 0) rc = err;
+    }
+  }
+  return rc;
+}
+
+void PageFile::evictFrame(int frame)
+{
+  if (cache[frame].file == NULL) return;
+
+  // remove the frame from its hash chain
+  int* link = &hashTable[hashOf(cache[frame].file, cache[frame].pid)];
+  while (*link != frame) link = &cache[*link].hashNext;
+  *link = cache[frame].hashNext;
+
+  // and from the frame list of its file
+  {
+    fileEntry* file = cache[frame].file;
+    LatchGuard guard(file->latch);
+    int prev = cache[frame].filePrev;
+    int next = cache[frame].fileNext;
+    if (prev >= 0) cache[prev].fileNext = next; else file->frames = next;
+    if (next >= 0) cache[next].filePrev = prev;
+    cache[frame].filePrev = cache[frame].fileNext = -1;
+  }
+
+  cache[frame].file = NULL;
+  cache[frame].pid = 0;
+  cache[frame].pinCount = 0;
+  cache[frame].dirty = false;
+  cache[frame].pending = PENDING_NONE;
+  cache[frame].hashNext = -1;
+
+  pushFrame(frame, QUEUE_FREE);
+}
+
+void PageFile::touchFrame(int frame)
+{
+  // 2Q leaves a page on probation alone: repeated requests right after
+  // the page is read are usually the same scan looking at it again
+  if (cache[frame].queue == QUEUE_A1) return;
+
+  cacheQueue* queues = partitions[cache[frame].part].queues;
+  if (frame != queues[cache[frame].queue].head) pushFrame(frame, cache[frame].queue);
+}
+
+void PageFile::pushFrame(int frame, int queue)
+{
+  unlinkFrame(frame);
+
+  // insert the frame at the head of the queue
+  cacheQueue& q = partitions[cache[frame].part].queues[queue];
+  cache[frame].queue = queue;
+  cache[frame].lruPrev = -1;
+  cache[frame].lruNext = q.head;
+  if (q.head >= 0) cache[q.head].lruPrev = frame; else q.tail = frame;
+  q.head = frame;
+  q.size++;
+}
+
+void PageFile::unlinkFrame(int frame)
+{
+  if (cache[frame].queue < 0) return;
+
+  cacheQueue& q = partitions[cache[frame].part].queues[cache[frame].queue];
+  int prev = cache[frame].lruPrev;
+  int next = cache[frame].lruNext;
+
+  if (prev >= 0) cache[prev].lruNext = next; else q.head = next;
+  if (next >= 0) cache[next].lruPrev = prev; else q.tail = prev;
+  q.size--;
+  cache[frame].queue = -1;
+  cache[frame].lruPrev = cache[frame].lruNext = -1;
+}
+
+void PageFile::framesOf(fileEntry* file, std::vector<std::pair<PageId, int> >& frames)
+{
+  // the frames are listed as (pid, frame) pairs. the caller checks each
+  // frame again under its partition latch before using it.
+  LatchGuard guard(file->latch);
+  for (int i = file->frames; i >= 0; i = cache[i].fileNext) {
+    frames.push_back(std::make_pair(cache[i].pid, i));
+  }
+}
+
+void PageFile::addGhost(fileEntry* file, PageId pid)
+{
+  // the ghost ring of the page's partition is a FIFO:
+  // overwrite the oldest entry
+  cachePartition& part = partitionOf(file, pid);
+  ghostEntry& g = ghosts[part.ghostFirst + part.ghostNext];
+  if (g.file != NULL) takeGhost(g.file, g.pid);
+  part.ghostNext = (part.ghostNext + 1) % part.ghostCount;
+
+  int bucket = hashOf(file, pid);
+  g.file = file;
+  g.pid = pid;
+  g.hashNext = ghostTable[bucket];
+  ghostTable[bucket] = &g - ghosts;
+}
+
+bool PageFile::takeGhost(const fileEntry* file, PageId pid)
+{
+  for (int* link = &ghostTable[hashOf(file, pid)]; *link >= 0; link = &ghosts[*link].hashNext) {
+    ghostEntry& g = ghosts[*link];
+    if (g.file == file && g.pid == pid) {
+      *link = g.hashNext;
+      g.file = NULL;
+      g.hashNext = -1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PageFile::dropGhosts(const fileEntry* file)
+{
+  for (int p = 0; p < partitionCount; p++) {
+    cachePartition& part = partitions[p];
+    LatchGuard guard(part.latch);
+    for (int i = part.ghostFirst; i < part.ghostFirst + part.ghostCount; i++) {
+      if (ghosts[i].file == file) takeGhost(file, ghosts[i].pid);
+    }
+  }
+}
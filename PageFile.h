@@ -10,41 +10,88 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <pthread.h>
+#include <sys/types.h>
 #include <string>
+#include <vector>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ * the page size is chosen when a file is created and is recorded in a
+ * header page at the start of the file. files without the header use
+ * PAGE_SIZE pages.
+ * the buffer pool is shared by all files and may be used by several
+ * threads at once, e.g., one per query. a PageFile object itself is not
+ * shared: every thread opens the files it works on with its own PageFile.
+ * the pages are cached by the identity of the disk file (its device and
+ * inode), so all the PageFiles that have one file open see the same
+ * cached pages, dirty ones included.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = 1024;    // the default size of a page is 1KB
+  static const int MIN_PAGE_SIZE = 512;    // page sizes are powers of 2
+  static const int MAX_PAGE_SIZE = 65536;  // between these two
+  static const int MAX_IO_RUN = 64;     // max # of pages per vectored I/O
+
+  /**
+   * replacement policies of the buffer pool.
+   * LRU evicts the least recently used page.
+   * TWO_Q is the 2Q policy: a page first enters a FIFO probation queue and
+   * moves to the LRU main queue only when it is requested again after it
+   * was evicted from probation, so a one-time scan cannot flush hot pages.
+   */
+  enum CachePolicy { LRU, TWO_Q };
+
+  /**
+   * I/O backends for the asynchronous reads started by queueRead().
+   * IO_SYNC reads every page right away with a blocking system call.
+   * IO_URING keeps many reads in flight at once through io_uring.
+   */
+  enum IoBackend { IO_SYNC, IO_URING };
 
   PageFile();
   PageFile(const std::string& filename, char mode);
+  ~PageFile();
 
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with pages of getDefaultPageSize() bytes.
+   * 'm' opens the file read-only and maps it into memory, so that pages
+   * are served from the mapping instead of the buffer pool. the mapping
+   * grows when the file does. the dirty pages other PageFiles left in the
+   * pool are flushed first, so that the mapping sees them; the pages they
+   * write later show up in the mapping only once they are flushed.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for memory-mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
 
   /**
-   * close the file.
+   * close the file. dirty pages of the file are flushed to disk first.
+   * the cached pages of the file are dropped when the last PageFile
+   * that has the file open closes it.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * write all dirty cached pages of the file to disk, in page order,
+   * whichever PageFile wrote them.
+   * @return error code. 0 if no error
+   */
+  RC flush();
   
   /**
    * read a disk page into memory buffer.
    * @param pid[IN] the page to read
-   * @param buffer[OUT] pointer to memory buffer
+   * @param buffer[OUT] pointer to memory buffer of pageSize() bytes
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
@@ -53,11 +100,92 @@ class PageFile {
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * in write-back mode the page is only copied into the buffer pool and
+   * marked dirty; it reaches the disk when it is evicted or flushed.
+   * the cached frame of a page pinned by another thread is not changed
+   * under it: the write waits until the page is unpinned, so a thread
+   * must not write a page it holds pinned itself.
    * @param pid[IN] page to write to
-   * @param buffer[IN] the content to write
+   * @param buffer[IN] the content to write, pageSize() bytes
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * read a run of contiguous disk pages into memory buffer.
+   * the pages missing from the buffer pool are read with one vectored
+   * system call per run of up to MAX_IO_RUN pages.
+   * @param pid[IN] the first page to read
+   * @param count[IN] the # of pages to read
+   * @param buffer[OUT] pointer to memory buffer of (count * pageSize()) bytes
+   * @return error code. 0 if no error
+   */
+  RC readPages(PageId pid, int count, void *buffer) const;
+
+  /**
+   * write a run of contiguous pages from the memory buffer.
+   * in write-through mode the run goes to disk with one system call.
+   * like write(), it waits for pins on the pages to be released.
+   * if (pid + count > endPid()), the file is expanded such that
+   * endPid() becomes (pid + count).
+   * @param pid[IN] the first page to write to
+   * @param count[IN] the # of pages to write
+   * @param buffer[IN] the content to write, (count * pageSize()) bytes
+   * @return error code. 0 if no error
+   */
+  RC writePages(PageId pid, int count, const void *buffer);
+
+  /**
+   * start reading a page into the buffer pool without waiting for it.
+   * the read is only queued; submitReads() hands the queued reads to the
+   * kernel in one batch. the frame of the page is reserved, and any
+   * request for the page waits until its read completes.
+   * with the IO_SYNC backend, the page is read right away.
+   * @param pid[IN] the page to read
+   * @return error code. 0 if no error
+   */
+  RC queueRead(PageId pid) const;
+
+  /**
+   * start all reads queued by queueRead() without waiting for them.
+   * @return error code. 0 if no error
+   */
+  RC submitReads() const;
+
+  /**
+   * wait until all reads started by queueRead() are done.
+   * @return error code. 0 if no error
+   */
+  RC completeReads() const;
+
+  /**
+   * tell the file whether it is about to be read sequentially.
+   * a sequential file asks the kernel to prefetch getReadAhead() pages
+   * ahead of every page read, without waiting for the access pattern
+   * to be detected. a non-sequential file still reads ahead once it sees
+   * READ_AHEAD_TRIGGER consecutive pages requested in order.
+   * @param on[IN] true if the file will be scanned in page order
+   * @return error code. 0 if no error
+   */
+  RC setSequential(bool on);
+
+  /**
+   * pin a disk page in the buffer pool and return a pointer to its frame.
+   * the frame stays in memory until unpin() is called, so the caller can
+   * use the page without copying it. the frame must not be modified.
+   * every successful pin() must be matched by one unpin().
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the cached frame of the page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, const char*& page) const;
+
+  /**
+   * release a page pinned by pin(). the frame may be evicted afterwards.
+   * @param pid[IN] the page to unpin
+   * @return error code. 0 if no error
+   */
+  RC unpin(PageId pid) const;
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -66,6 +194,25 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the size of a page of the file in bytes
+   */
+  int pageSize() const { return psize; }
+
+  /**
+   * set the page size of the files created from now on.
+   * existing files keep the page size they were created with.
+   * @param size[IN] the page size in bytes, a power of 2 between
+   *                 MIN_PAGE_SIZE and MAX_PAGE_SIZE
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * @return the page size of the files created from now on
+   */
+  static int getDefaultPageSize() { return defaultPageSize; }
+
   /**
    * @return the total # of disk reads
    */
@@ -76,37 +223,302 @@ class PageFile {
    */
   static int getPageWriteCount() { return writeCount; }
 
+  /**
+   * @return the total # of disk writes of dirty pages from the buffer pool
+   */
+  static int getPageFlushCount() { return flushCount; }
+
+  /**
+   * turn write-back caching on or off. when it is turned off,
+   * all dirty pages are flushed and write() goes straight to disk.
+   * @param on[IN] true for write-back, false for write-through
+   * @return error code. 0 if no error
+   */
+  static RC setWriteBack(bool on);
+
+  /**
+   * @return true if write-back caching is on
+   */
+  static bool getWriteBack() { return writeBack; }
+
+  /**
+   * set the number of page frames in the buffer pool shared by all files.
+   * dirty pages are flushed and all cached pages are discarded,
+   * so this should be called at startup
+   * before any file is opened, any page is pinned,
+   * or any other thread uses the pool.
+   * the pool is left as it is if any page is pinned.
+   * @param count[IN] the number of frames in the pool (> 0)
+   * @return error code. 0 if no error. RC_PAGE_PINNED if a page is pinned
+   */
+  static RC setCacheSize(int count);
+
+  /**
+   * choose the backend of queueRead(). if io_uring is not available,
+   * the backend stays IO_SYNC and an error code is returned.
+   * @param backend[IN] the I/O backend
+   * @return error code. 0 if no error
+   */
+  static RC setIoBackend(IoBackend backend);
+
+  /**
+   * @return the I/O backend of queueRead()
+   */
+  static IoBackend getIoBackend() { return ioBackend; }
+
+  /**
+   * set how many pages are prefetched ahead of a sequential reader.
+   * prefetching is done in the background by the kernel, so reads
+   * that follow find the pages already in memory. 0 turns it off.
+   * @param pages[IN] the read-ahead depth in pages (>= 0)
+   * @return error code. 0 if no error
+   */
+  static RC setReadAhead(int pages);
+
+  /**
+   * @return the read-ahead depth in pages
+   */
+  static int getReadAhead() { return readAhead; }
+
+  /**
+   * @return the total # of pages requested from the kernel by read-ahead
+   */
+  static int getPagePrefetchCount() { return prefetchCount; }
+
+  /**
+   * @return the number of page frames in the buffer pool
+   */
+  static int getCacheSize();
+
+  /**
+   * choose the replacement policy of the buffer pool. like setCacheSize(),
+   * dirty pages are flushed and all cached pages are discarded, and
+   * nothing changes if any page is pinned.
+   * @param policy[IN] the replacement policy
+   * @return error code. 0 if no error. RC_PAGE_PINNED if a page is pinned
+   */
+  static RC setCachePolicy(CachePolicy policy);
+
+  /**
+   * @return the replacement policy of the buffer pool
+   */
+  static CachePolicy getCachePolicy() { return cachePolicy; }
+
+  /**
+   * @return the total # of page requests served from memory, either from
+   * the buffer pool or from a memory-mapped file.
+   * the # of misses is getPageReadCount().
+   */
+  static int getCacheHitCount() { return hitCount; }
+
  protected:
   /**
-   * move the file cursor to the beginning of a page.
+   * return the page inside the memory mapping of a file opened in 'm'
+   * mode, growing the mapping if the file has grown since it was made.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the page to look up
+   * @return pointer to the page, or NULL if the page is not mapped
+   */
+  const char* mapped(PageId pid) const;
+
+  /**
+   * note that the page is about to be read and prefetch the pages after
+   * it if the file is being read sequentially.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the page about to be read
+   */
+  void readAheadFrom(PageId pid) const;
+
+  /**
+   * map the whole file again if it has grown. the old mapping is kept
+   * while pages in it are pinned, and pages past it go through the pool.
+   * this is an internal function not exposed to public.
+   * @return error code. 0 if no error
+   */
+  RC remap() const;
+
+  /**
+   * read the header page of the file and set up its page size,
+   * writing a new header if the file is empty and writable.
    * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC readHeader();
+
+  /**
+   * @return the offset of page pid in the disk file
+   */
+  off_t offsetOf(PageId pid) const { return base + (off_t) pid * psize; }
+
+  /**
+   * find the frame holding the page and pin it, reading it from disk if
+   * necessary. a missing page is read together with the missing pages
+   * after it, up to count pages, with one vectored system call.
+   * the frame must be released with releaseFrame().
+   * this is an internal function not exposed to public.
+   * @param pid[IN] page to fetch
+   * @param frame[OUT] the frame that holds the page
+   * @param count[IN] the # of pages to read if the page is missing (<= MAX_IO_RUN)
+   * @return error code. 0 if no error
+   */
+  RC fetch(PageId pid, int& frame, int count = 1) const;
 
  private:
+  // every disk file that is open in some PageFile has one entry, which
+  // all the PageFiles that have the file open share.
+  struct fileEntry {
+    dev_t  dev;         // the device of the file
+    ino_t  ino;         // the inode of the file
+    int    id;          // a number no other open file has, for hashing
+    int    opens;       // # PageFiles that have the file open
+    int    fd;          // descriptor for writing dirty pages back (-1: none)
+    PageId epid;        // (last page id + 1) of the file, cached pages included
+    int    frames;      // first frame holding a page of the file (-1: none)
+    pthread_mutex_t latch; // guards the frame list of the file
+    fileEntry* next;    // the next entry in the list of open files
+  };
+
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  fileEntry* file;        // the shared entry of the file (NULL if not open)
+  bool    writable;       // false if opened in 'r' or 'm' mode
+  int     psize;          // the size of a page of the file
+  off_t   base;           // the offset of page 0, right after the header
+
+  bool    sequential;     // true if the reader promised to scan in order
+  mutable PageId  lastPid;  // the last page read, for detecting sequential access
+  mutable int     seqCount; // # consecutive pages read in order up to lastPid
+  mutable PageId  aheadPid; // pages before this one were already prefetched
 
+  mutable char*   map;      // memory mapping of the file in 'm' mode
+  mutable PageId  mapPages; // # pages covered by the mapping
+  mutable int     mapPins;  // # pages pinned inside the mapping
+  mutable int     poolPins; // # pages past the mapping pinned in the pool
+
+  //
+  // the following set of members implement the buffer pool.
+  // frames are looked up through a hash table keyed on (file, pid).
+  // every frame sits on one of the doubly-linked queues below, and the
+  // replacement policy decides which queue a page enters and leaves from.
   //
-  // the following set of members implement LRU caching 
+  // the frames holding the pages of a file are also linked in a list
+  // kept in its entry, so that closing or flushing a file only looks at
+  // its own frames. the latch of the list is taken after the partition's.
   //
-  static const int CACHE_COUNT = 10;
+  // the pool is split into partitions, each with its own latch, frames,
+  // queues and ghosts. a page always goes to the partition that owns its
+  // hash bucket, so threads working on different pages rarely wait for
+  // each other. no partition latch is held while waiting for another one.
+  //
+  static const int DEFAULT_CACHE_COUNT = 1024;
+  static const int DEFAULT_READ_AHEAD = 32;
+  static const int IO_RING_ENTRIES = 256;
+  static const int READ_AHEAD_TRIGGER = 3;
+  static const int MAX_PARTITIONS = 16;
+  static const int MIN_PARTITION_FRAMES = 32;  // smaller pools are split less
+
+  static const int QUEUE_FREE = 0;  // empty frames, always used first
+  static const int QUEUE_A1   = 1;  // 2Q probation queue (FIFO)
+  static const int QUEUE_AM   = 2;  // main queue (LRU)
+  static const int QUEUE_COUNT = 3;
+
+  static const char PENDING_NONE  = 0;  // the frame holds its page
+  static const char PENDING_READ  = 1;  // a thread is reading the page into it
+  static const char PENDING_ASYNC = 2;  // an io_uring read is filling it
+
+  static struct cacheFrame {
+    fileEntry* file;    // file of the cached page (NULL if the frame is empty)
+    PageId pid;         // page id of the cached page
+    int    part;        // the partition that owns the frame
+    int    size;        // the page size of the cached page
+    off_t  offset;      // the offset of the cached page in its disk file
+    int    capacity;    // # bytes allocated for buffer
+    int    pinCount;    // # outstanding pins; pinned frames stay put
+    bool   dirty;       // true if the frame is newer than the disk page
+    unsigned version;   // bumped whenever the page is written into the frame
+    char   pending;     // PENDING_NONE unless a read is filling the frame
+    int    hashNext;    // next frame in the same hash bucket (-1: none)
+    int    queue;       // the queue the frame is on
+    int    lruPrev;     // previous (more recently used) frame (-1: none)
+    int    lruNext;     // next (less recently used) frame (-1: none)
+    int    filePrev;    // previous frame of the same file (-1: none)
+    int    fileNext;    // next frame of the same file (-1: none)
+    char*  buffer;      // the buffer used for caching (NULL until first used)
+  } *cache;
+
+  struct cacheQueue {
+    int head;           // the most recently inserted or used frame
+    int tail;           // the next frame to evict
+    int size;           // # frames on the queue
+  };
+
+  // 2Q remembers the pages recently evicted from probation (its "A1out"
+  // queue), so that a page requested again soon goes to the main queue.
+  static struct ghostEntry {
+    fileEntry* file;    // file of the evicted page (NULL if unused)
+    PageId pid;         // page id of the evicted page
+    int    hashNext;    // next entry in the same hash bucket (-1: none)
+  } *ghosts;
+
+  static struct cachePartition {
+    pthread_mutex_t latch;  // guards the partition, its frames and buckets
+    pthread_cond_t  filled; // signaled when a pending frame is filled
+    pthread_cond_t  unpinned; // signaled when a frame loses its last pin
+    int    first;           // the first frame of the partition
+    int    count;           // # frames in the partition
+    int    ghostFirst;      // the first ghost entry of the partition
+    int    ghostCount;      // # entries in the partition's ghost ring
+    int    ghostNext;       // the ghost entry to overwrite next
+    cacheQueue queues[QUEUE_COUNT];
+  } *partitions;
 
-  static int cacheClock; // clock tick counter for LRU policy
+  static int   cacheCount;  // # frames in the pool
+  static int   partitionCount; // # partitions; a power of 2
+  static int*  hashTable;   // first frame of each hash bucket (-1: none)
+  static int   hashMask;    // (# hash buckets - 1); # buckets is a power of 2
+  static int*  ghostTable;  // first ghost entry of each hash bucket
+  static CachePolicy cachePolicy;
+  static bool  writeBack;   // true: write() only updates the cache
+  static int   readAhead;   // # pages to prefetch ahead of a sequential read
+  static IoBackend ioBackend;
+  static int   defaultPageSize; // the page size of new files
+  static int   pendingCount; // # frames waiting for an asynchronous read
+  static pthread_mutex_t ioLatch;     // guards the io_uring and pendingCount
+  static pthread_mutex_t configLatch; // guards the creation of the pool
+  static fileEntry* openFiles; // the entries of the open files
+  static int   nextFileId;  // the id of the next file entry
+  static pthread_mutex_t fileLatch;   // guards openFiles and the open counts
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  static void initCache();
+  static void freeCache();
+  static bool anyPinned();
+  static int  hashOf(const fileEntry* file, PageId pid);
+  static cachePartition& partitionOf(const fileEntry* file, PageId pid);
+  static int  findFrame(const fileEntry* file, PageId pid, bool wait = true);
+  static RC   allocFrame(fileEntry* file, PageId pid, int size, off_t offset, int& frame);
+  static int  victimFrame(cachePartition& part);
+  static int  findUnpinned(const fileEntry* file, PageId pid);
+  static void releaseFrame(int frame);
+  static void dropPin(int frame);
+  static void refreshFrame(int frame, const void* buffer);
+  static RC   flushFrame(int frame);
+  static RC   flushRun(const int* frames, int count);
+  static RC   flushAll();
+  static RC   completeAll();
+  static void evictFrame(int frame);
+  static void touchFrame(int frame);
+  static void pushFrame(int frame, int queue);
+  static void unlinkFrame(int frame);
+  static void framesOf(fileEntry* file, std::vector<std::pair<PageId, int> >& frames);
+  static void addGhost(fileEntry* file, PageId pid);
+  static bool takeGhost(const fileEntry* file, PageId pid);
+  static void dropGhosts(const fileEntry* file);
 
+  // the counters are updated atomically, since any thread may bump them
   static int readCount;  // total # of page reads 
   static int writeCount; // total # of page writes 
+  static int flushCount; // total # of dirty page writes
+  static int hitCount;   // total # of page requests served from the cache
+  static int prefetchCount; // total # of pages prefetched by read-ahead
 };
   
 #endif // PAGEFILE_H
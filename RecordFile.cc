@@ -9,6 +9,7 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include <cstring>
 
 using std::string;
 
@@ -116,7 +117,7 @@ RecordFile::RecordFile(const string& filename, char mode)
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  char page[PageFile::MAX_PAGE_SIZE];
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
@@ -147,7 +148,7 @@ RC RecordFile::open(const string& filename, char mode)
 
   // get # records in the last page
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  if (erid.sid >= recordsPerPage()) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
@@ -167,26 +168,27 @@ RC RecordFile::close()
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  const char* page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= recordsPerPage()) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record. only one slot is needed,
+  // so there is no point in copying the whole page out of the cache.
+  if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
 
   // read the record from the slot in the page
   readSlot(page, rid.sid, key, value);
 
-  return 0;
+  return pf.unpin(rid.pid);
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  char page[PageFile::MAX_PAGE_SIZE];
 
   // unless we are writing to the the first slot of an empty page,
   // we have to read the page first
@@ -195,7 +197,7 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    memset(page, 0, pf.pageSize());
   }
     
   // write the record to the first empty slot 
@@ -212,11 +214,47 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  next(erid);
 
   return 0;
 }
 
+RC RecordFile::prefetch(const RecordId* rids, int count) const
+{
+  RC rc;
+
+  for (int i = 0; i < count; i++) {
+    if (rids[i].pid < 0 || rids[i] >= erid) continue;
+    // records on the same page are usually next to each other
+    if (i > 0 && rids[i].pid == rids[i-1].pid) continue;
+    if ((rc = pf.queueRead(rids[i].pid)) < 0) return rc;
+  }
+
+  return pf.submitReads();
+}
+
+int RecordFile::recordsPerPage() const
+{
+  // the first four bytes of a page store # records in the page
+  return (pf.pageSize() - sizeof(int)) / (sizeof(int) + MAX_VALUE_LENGTH);
+}
+
+RecordId& RecordFile::next(RecordId& rid) const
+{
+  // if the end of a page is reached, move to the next page
+  if (++rid.sid >= recordsPerPage()) {
+    rid.pid++;
+    rid.sid = 0;
+  }
+
+  return rid;
+}
+
+RC RecordFile::setSequential(bool on)
+{
+  return pf.setSequential(on);
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
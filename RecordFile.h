@@ -26,7 +26,8 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
+// RecordId iterators. they assume RECORDS_PER_PAGE slots per page;
+// use RecordFile::next() for a file with another page size.
 RecordId& operator++ (RecordId& rid);
 RecordId  operator++ (RecordId& rid, int);
 
@@ -47,7 +48,8 @@ class RecordFile {
   // maximum length of the value field
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  // number of record slots per page of the default size.
+  // the actual number for a file is recordsPerPage().
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
@@ -90,6 +92,37 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * start reading the pages of the given records in the background,
+   * so that later read() calls on them do not wait for the disk one
+   * page at a time. with the io_uring backend of PageFile, all the
+   * pages are in flight at once.
+   * @param rids[IN] the records that will be read soon
+   * @param count[IN] the # of records in rids
+   * @return error code. 0 if no error
+   */
+  RC prefetch(const RecordId* rids, int count) const;
+
+  /**
+   * tell the file that its records are about to be read in rid order,
+   * so that the pages ahead of the reader are prefetched.
+   * @param on[IN] true if the file will be scanned in rid order
+   * @return error code. 0 if no error
+   */
+  RC setSequential(bool on);
+
+  /**
+   * @return the number of record slots per page of the file
+   */
+  int recordsPerPage() const;
+
+  /**
+   * advance a record id to the next record slot of the file.
+   * @param rid[IN/OUT] the record id to advance
+   * @return rid
+   */
+  RecordId& next(RecordId& rid) const;
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
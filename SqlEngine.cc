@@ -8,6 +8,9 @@
  */
 
 #include <cstdio>
+#include <climits>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include "Bruinbase.h"
@@ -20,6 +23,8 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+bool SqlEngine::mapReads = false;
+double SqlEngine::fillFactor = 0.9;
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -33,179 +38,435 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
+// Access paths of select(), named after the attribute they are ordered by
+static const int TABLE_SCAN = 0;
+static const int KEY_INDEX = 1;
+static const int VALUE_INDEX = 2;
+
+// # RecordIds select() collects from an index before reading their tuples
+static const unsigned FETCH_BATCH = 1024;
+
+/*
+ * Check the conditions on a tuple.
+ * @param order[IN] the attribute the tuples come sorted by, or TABLE_SCAN
+ * @return 0 if the tuple meets the conditions, 1 if it does not, and -1
+ *         if no later tuple can meet them: the tuples are sorted and an
+ *         upper bound (=, <, <=) on the sorted attribute is passed.
+ */
+static int checkConditions(const vector<SelCond>& cond, int key, const string& value, int order)
+{
+  int diff = 0;
+  int rc = 0;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    // compute the difference between the tuple value and the condition value
+    switch (cond[i].attr) {
+    case 1:
+      // compare rather than subtract, which overflows near INT_MIN/INT_MAX
+      diff = (key > atoi(cond[i].value)) - (key < atoi(cond[i].value));
+      break;
+    case 2:
+      diff = strcmp(value.c_str(), cond[i].value);
+      break;
+    }
+
+    // skip the tuple if any condition is not met
+    bool met = true;
+    bool upper = false;
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      met = (diff == 0);
+      upper = (diff > 0);
+      break;
+    case SelCond::NE:
+      met = (diff != 0);
+      break;
+    case SelCond::GT:
+      met = (diff > 0);
+      break;
+    case SelCond::LT:
+      met = (diff < 0);
+      upper = !met;
+      break;
+    case SelCond::GE:
+      met = (diff >= 0);
+      break;
+    case SelCond::LE:
+      met = (diff <= 0);
+      upper = !met;
+      break;
+    }
+    if (!met) {
+      if (upper && cond[i].attr == order) return -1;
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+/*
+ * Find the range of keys that can meet the conditions on the key.
+ * A <> condition is left out, so some keys in the range may not meet it.
+ * @param low[OUT] the smallest key in the range
+ * @param high[OUT] the largest key in the range
+ * @return false if no key can meet the conditions
+ */
+static bool keyRange(const vector<SelCond>& cond, int& low, int& high)
+{
+  low = INT_MIN;
+  high = INT_MAX;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) continue;
+    int v = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      low = max(low, v);
+      high = min(high, v);
+      break;
+    case SelCond::GE:
+      low = max(low, v);
+      break;
+    case SelCond::GT:
+      if (v == INT_MAX) return false;
+      low = max(low, v+1);
+      break;
+    case SelCond::LE:
+      high = min(high, v);
+      break;
+    case SelCond::LT:
+      if (v == INT_MIN) return false;
+      high = min(high, v-1);
+      break;
+    default:
+      break;
+    }
+  }
+  return low <= high;
+}
+
+/*
+ * Count the tuples meeting conditions on the key alone with a counted
+ * index, if the conditions bound a single range of keys.
+ * @param count[OUT] the # tuples meeting the conditions
+ * @return error code. 0 if no error
+ */
+static RC countKeyRange(const vector<SelCond>& cond, BTreeIndex& index, int& count)
+{
+  int low, high;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].comp == SelCond::NE) return RC_INVALID_ATTRIBUTE;  // a hole in the range
+  }
+  if (!keyRange(cond, low, high)) {
+    count = 0;
+    return 0;
+  }
+  return index.countRange(low, high, count);
+}
+
+/*
+ * Collect the RecordIds of the next index entries whose indexed attribute
+ * meets its conditions, up to limit of them, sorted by RecordId.
+ * @param path[IN] KEY_INDEX to read from scan, VALUE_INDEX from cursor
+ * @param indexCond[IN] the conditions on the indexed attribute
+ * @param done[IN/OUT] true once no later index entry can meet them
+ * @param limit[IN] the most RecordIds to return
+ * @param batch[OUT] the RecordIds, none once done
+ */
+static void fetchBatch(int path, const vector<SelCond>& indexCond, BTreeScan& scan,
+                       BTreeStringIndex& vindex, IndexCursor& cursor, bool& done,
+                       unsigned limit, vector<RecordId>& batch)
+{
+  int      key = 0;
+  string   value;
+  RecordId rid;
+
+  batch.clear();
+  while (!done && batch.size() < limit) {
+    if (path == KEY_INDEX) done = (scan.next(key, rid) != 0);
+    else done = (vindex.readForward(cursor, value, rid) != 0);
+    if (done) break;
+
+    int match = checkConditions(indexCond, key, value, path);
+    if (match < 0) done = true;
+    if (match == 0) batch.push_back(rid);
+  }
+  sort(batch.begin(), batch.end());
+}
+
+/*
+ * Print a tuple that meets the conditions of a SELECT.
+ * @param attr[IN] the attribute in the SELECT clause; COUNT(*) prints nothing
+ */
+static void printTuple(int attr, int key, const string& value)
+{
+  switch (attr) {
+  case 1:  // SELECT key
+    fprintf(stdout, "%d\n", key);
+    break;
+  case 2:  // SELECT value
+    fprintf(stdout, "%s\n", value.c_str());
+    break;
+  case 3:  // SELECT *
+    fprintf(stdout, "%d '%s'\n", key, value.c_str());
+    break;
+  }
+}
+
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
   RecordId   rid;  // record cursor for table scanning
   BTreeIndex btindex;
-  IndexCursor cursor;
-  
+  BTreeStringIndex vindex;
+  BTreeScan   scan;    // key order scan of btindex
+  IndexCursor cursor;  // value order cursor of vindex
+  IndexStats  stats;   // the statistics of btindex
+  vector<SelCond>  indexCond;  // the conditions on the indexed attribute
+  vector<RecordId> batch;      // the RecordIds found through the index
+  unsigned next = 0;           // the next RecordId of batch to read
+  unsigned batchLimit;         // the most RecordIds in a batch
+  bool indexDone = false;      // true once the index has no more to give
 
   RC     rc;
   int    key;     
   string value;
   int    count;
-  int    diff;
+  int    path;
+  bool   covered;
 
   // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+  char mode = mapReads ? 'm' : 'r';
+  if ((rc = rf.open(table + ".tbl", mode)) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
 
-  // scan the table file from the beginning
+  // find where an index scan can start: the largest lower bound
+  // (=, >, >=) on the key and on the value,
+  // and where a key scan can end: the smallest upper bound (=, <, <=)
+  int keyStart = -1, valueStart = -1;
+  int keyEnd = INT_MAX;
+  bool keyBound = false, valueBound = false;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].comp == SelCond::NE) continue;
+    if (cond[i].attr == 1) {
+      keyBound = true;
+      int v = atoi(cond[i].value);
+      if (cond[i].comp == SelCond::EQ || cond[i].comp == SelCond::LE) keyEnd = min(keyEnd, v);
+      if (cond[i].comp == SelCond::LT) keyEnd = min(keyEnd, (v == INT_MIN) ? v : v-1);
+      if (cond[i].comp != SelCond::EQ && cond[i].comp != SelCond::GT && cond[i].comp != SelCond::GE) continue;
+      if (keyStart >= 0 && cond[keyStart].comp == SelCond::EQ) continue; // EQ has highest priority
+      if (keyStart < 0 || cond[i].comp == SelCond::EQ || atoi(cond[i].value) > atoi(cond[keyStart].value))
+        keyStart = i;
+    } else {
+      valueBound = true;
+      if (cond[i].comp != SelCond::EQ && cond[i].comp != SelCond::GT && cond[i].comp != SelCond::GE) continue;
+      if (valueStart >= 0 && cond[valueStart].comp == SelCond::EQ) continue;
+      if (valueStart < 0 || cond[i].comp == SelCond::EQ || strcmp(cond[i].value, cond[valueStart].value) > 0)
+        valueStart = i;
+    }
+  }
+
+  // use the value index when only the value is bounded,
+  // the key index when there is one, and scan the table otherwise
+  if (!keyBound && valueBound && vindex.open(table + ".vidx", mode) == 0) {
+    path = VALUE_INDEX;
+    vindex.locate(valueStart >= 0 ? string(cond[valueStart].value) : string(), cursor);
+  } else if (openIndex(table, mode, btindex) == 0) {
+    path = KEY_INDEX;
+  } else {
+    path = TABLE_SCAN;
+    rf.setSequential(true); // Full scan reads the pages in order
+  }
+
+  // the index alone answers a query that needs nothing but the attribute
+  // it is ordered by: SELECT key or COUNT(*) with conditions on the key
+  // only, and SELECT value or COUNT(*) with conditions on the value only
+  covered = (path != TABLE_SCAN && (attr == path || attr == 4));
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != path) covered = false;
+  }
+
+  // a counted key index answers COUNT(*) over a range of keys at once
+  if (attr == 4 && covered && path == KEY_INDEX && countKeyRange(cond, btindex, count) == 0) {
+    goto print_count;
+  }
+
+  // the statistics of the key index rule out a range of keys outside the
+  // ones it holds, and send a wide range to a table scan unless the index
+  // covers the query: each tuple found through the index is a page read.
+  // with io_uring the pages of a batch are read in parallel, which keeps
+  // the index ahead of a scan up to about two tuples per table page
+  if (path == KEY_INDEX && btindex.getStats(stats) == 0) {
+    int low, high, estimate;
+    if (!keyRange(cond, low, high) || stats.entryCount == 0 ||
+        low > stats.maxKey || high < stats.minKey) {
+      count = 0;
+      goto print_count;
+    }
+    if (!covered && btindex.estimateRange(low, high, estimate) == 0 &&
+        estimate > rf.endRid().pid * (PageFile::getIoBackend() == PageFile::IO_URING ? 2 : 1)) {
+      path = TABLE_SCAN;
+      rf.setSequential(true);
+    }
+  }
+  if (path == KEY_INDEX) {
+    scan.open(btindex, keyStart >= 0 ? atoi(cond[keyStart].value) : INT_MIN, keyEnd);
+  }
+  // a batch is kept to half the buffer pool, so that its prefetched
+  // pages are still there when its tuples are read
+  batchLimit = min(FETCH_BATCH, (unsigned) max(1, PageFile::getCacheSize() / 2));
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == path) indexCond.push_back(cond[i]);
+  }
+
+  // scan the table file from the beginning, or the index from the start
   rid.pid = rid.sid = 0;
   count = 0;
-  
-  if(!btindex.open(table+".idx",'r')) { //Index exists, do faster algorithm
-	int desiredKey = -1;
-	for (unsigned i = 0; i < cond.size(); i++) {
-		if(cond[i].attr != 1) continue; // Only works for keys
-		if(cond[i].comp == SelCond::EQ) { // EQ has highest priority
-			desiredKey = i;
-			break;
-		}
-		// If greater than, then advance the starting position
-		if(cond[i].comp == SelCond::GT || cond[i].comp == SelCond::GE)
-			// GT is larger than previous ones
-			if(desiredKey == -1 || atoi(cond[i].value) > atoi(cond[desiredKey].value))
-				desiredKey = i;
-	}
-	btindex.locate((desiredKey > -1 ? (atoi(cond[desiredKey].value)):0),cursor);
-			
-	  while (btindex.readForward(cursor,key,rid) != RC_END_OF_TREE) {
-		// read the tuple
-		if ((rc = rf.read(rid, key, value)) < 0) {
-		  fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-		  goto exit_select;
-		}
-		// check the conditions on the tuple
-		for (unsigned i = 0; i < cond.size(); i++) {
-		  // compute the difference between the tuple value and the condition value
-		  switch (cond[i].attr) {
-		  case 1:
-		diff = key - atoi(cond[i].value);
-		break;
-		  case 2:
-		diff = strcmp(value.c_str(), cond[i].value);
-		break;
-		  }
-
-		  //ATTR: 1 (key), 2 (value), 3(*)
-		  // skip the tuple if any condition is not met
-		  switch (cond[i].comp) {
-		  case SelCond::EQ:
-		if (diff != 0)
-			if (cond[i].attr == 1) goto exit_select; // Found the key
-			else continue; // Move to next tuple
-		break;
-		  case SelCond::NE:
-		if (diff == 0) continue;
-		break;
-		  case SelCond::GT:
-		if (diff <= 0) continue;
-		break;
-		  case SelCond::LT:
-		if (diff >= 0)
-			if (cond[i].attr == 1) goto exit_select;
-			else continue;
-		break;
-		  case SelCond::GE:
-		if (diff < 0) continue;
-		break;
-		  case SelCond::LE:
-		if (diff > 0)
-			if (cond[i].attr == 1) goto exit_select;
-			else continue;
-		break;
-		  }
-		}
-
-		// the condition is met for the tuple. 
-		// increase matching tuple counter
-		count++;
-
-		// print the tuple 
-		switch (attr) {
-		case 1:  // SELECT key
-		  fprintf(stdout, "%d\n", key);
-		  break;
-		case 2:  // SELECT value
-		  fprintf(stdout, "%s\n", value.c_str());
-		  break;
-		case 3:  // SELECT *
-		  fprintf(stdout, "%d '%s'\n", key, value.c_str());
-		  break;
-		}
-	  }
-	} else {
-		while (rid < rf.endRid()) {
-		// read the tuple
-		if ((rc = rf.read(rid, key, value)) < 0) {
-		  fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-		  goto exit_select;
-		}
-
-		
-		// check the conditions on the tuple
-		for (unsigned i = 0; i < cond.size(); i++) {
-		  // compute the difference between the tuple value and the condition value
-		  switch (cond[i].attr) {
-		  case 1:
-		diff = key - atoi(cond[i].value);
-		break;
-		  case 2:
-		diff = strcmp(value.c_str(), cond[i].value);
-		break;
-		  }
-
-		  // skip the tuple if any condition is not met
-		  switch (cond[i].comp) {
-		  case SelCond::EQ:
-		if (diff != 0) goto next_tuple;
-		break;
-		  case SelCond::NE:
-		if (diff == 0) goto next_tuple;
-		break;
-		  case SelCond::GT:
-		if (diff <= 0) goto next_tuple;
-		break;
-		  case SelCond::LT:
-		if (diff >= 0) goto next_tuple;
-		break;
-		  case SelCond::GE:
-		if (diff < 0) goto next_tuple;
-		break;
-		  case SelCond::LE:
-		if (diff > 0) goto next_tuple;
-		break;
-		  }
-		}
-
-		// the condition is met for the tuple. 
-		// increase matching tuple counter
-		count++;
-
-		// print the tuple 
-		switch (attr) {
-		case 1:  // SELECT key
-		  fprintf(stdout, "%d\n", key);
-		  break;
-		case 2:  // SELECT value
-		  fprintf(stdout, "%s\n", value.c_str());
-		  break;
-		case 3:  // SELECT *
-		  fprintf(stdout, "%d '%s'\n", key, value.c_str());
-		  break;
-		}
-
-		// move to the next tuple
-		next_tuple:
-		++rid;
-	  }
-	}
+  while (true) {
+    // find the next tuple
+    if (path == TABLE_SCAN) {
+      if (!(rid < rf.endRid())) break;
+    } else if (covered) {
+      if (path == KEY_INDEX && scan.next(key, rid) != 0) break;
+      if (path == VALUE_INDEX && vindex.readForward(cursor, value, rid) != 0) break;
+    } else {
+      // the tuples found through the index are read a batch at a time in
+      // table order, so that a table page is fetched once per batch
+      // instead of once per tuple, and its pages are prefetched together
+      if (next == batch.size()) {
+        fetchBatch(path, indexCond, scan, vindex, cursor, indexDone, batchLimit, batch);
+        if (batch.empty()) break;
+        rf.prefetch(&batch[0], batch.size());
+        next = 0;
+      }
+      rid = batch[next++];
+    }
+
+    // read the tuple, unless the index entry has all that is needed
+    if (!covered && (rc = rf.read(rid, key, value)) < 0) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
+    }
+    if (path == TABLE_SCAN) rf.next(rid);
+
+    // check the conditions on the tuple. only an index read one entry
+    // at a time still gives the tuples in the order of its attribute
+    int match = checkConditions(cond, key, value, covered ? path : TABLE_SCAN);
+    if (match < 0) break;
+    if (match > 0) continue;
+
+    // the condition is met for the tuple. 
+    // increase matching tuple counter
+    count++;
+
+    // print the tuple 
+    printTuple(attr, key, value);
+  }
+
+  // print matching tuple count if "select count(*)"
+  print_count:
+  if (attr == 4) {
+    fprintf(stdout, "%d\n", count);
+  }
+  rc = 0;
+
+  // close the table file and return
+  exit_select:
+  rf.close();
+  scan.close();
+  btindex.close();
+  vindex.close();
+  return rc;
+}
+
+RC SqlEngine::selectAny(int attr, const string& table, const vector<SelCond>& cond)
+{
+  RecordFile rf;   // RecordFile containing the table
+  RecordId   rid;  // record cursor for table scanning
+  BTreeIndex btindex;
+  vector<int> keys;                 // the keys of a list of key = conditions
+  vector<vector<RecordId> > found;  // the RecordIds of each of the keys
+  vector<RecordId> rids;            // all of them in table order
+  vector<vector<SelCond> > alt;     // each condition on its own
+  unsigned batchLimit;              // the most RecordIds prefetched at a time
+
+  RC     rc;
+  int    key;
+  string value;
+  int    count = 0;
+  bool   keyList = true;
+
+  // open the table file
+  char mode = mapReads ? 'm' : 'r';
+  if ((rc = rf.open(table + ".tbl", mode)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1 && cond[i].comp == SelCond::EQ) keys.push_back(atoi(cond[i].value));
+    else keyList = false;
+  }
+
+  if (!keyList || openIndex(table, mode, btindex) != 0) {
+    // scan the table, taking the tuples that meet any of the conditions
+    for (unsigned i = 0; i < cond.size(); i++) {
+      alt.push_back(vector<SelCond>(1, cond[i]));
+    }
+    rf.setSequential(true);
+    for (rid.pid = rid.sid = 0; rid < rf.endRid(); rf.next(rid)) {
+      if ((rc = rf.read(rid, key, value)) < 0) {
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        goto exit_select;
+      }
+      unsigned i = 0;
+      while (i < alt.size() && checkConditions(alt[i], key, value, TABLE_SCAN) != 0) i++;
+      if (i == alt.size()) continue;
+      count++;
+      printTuple(attr, key, value);
+    }
+    goto print_count;
+  }
+
+  // a list of keys is looked up in one walk of the key index.
+  // a key listed twice is still one match
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  if ((rc = btindex.locateBatch(keys, found)) < 0) {
+    fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+    goto exit_select;
+  }
+
+  // the index alone answers SELECT key and COUNT(*)
+  if (attr == 1 || attr == 4) {
+    for (unsigned i = 0; i < keys.size(); i++) {
+      count += found[i].size();
+      for (unsigned j = 0; attr == 1 && j < found[i].size(); j++) printTuple(attr, keys[i], value);
+    }
+    goto print_count;
+  }
+
+  // read the tuples in table order, prefetching a batch of pages at a time
+  for (unsigned i = 0; i < keys.size(); i++) {
+    rids.insert(rids.end(), found[i].begin(), found[i].end());
+  }
+  sort(rids.begin(), rids.end());
+  batchLimit = min(FETCH_BATCH, (unsigned) max(1, PageFile::getCacheSize() / 2));
+  for (unsigned i = 0; i < rids.size(); i++) {
+    if (i % batchLimit == 0) rf.prefetch(&rids[i], min(batchLimit, (unsigned) rids.size() - i));
+    if ((rc = rf.read(rids[i], key, value)) < 0) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
+    }
+    count++;
+    printTuple(attr, key, value);
+  }
 
   // print matching tuple count if "select count(*)"
+  print_count:
   if (attr == 4) {
     fprintf(stdout, "%d\n", count);
   }
@@ -235,29 +496,107 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   }
   
   BTreeIndex btindex;
+  BTreeStringIndex vindex; // on the value column
   if(index)
-	if(btindex.open(table+".idx",'w')) {
+	if(openIndex(table, 'w', btindex) || vindex.open(table+".vidx",'w')) {
 		cout << "Unable to open file.\n";
 		return 1;
 	}
+  if(index) { //Sort the pairs and build the indexes bottom-up at the end
+	btindex.beginBulkLoad(fillFactor);
+	vindex.beginBulkLoad(fillFactor);
+  }
   
   //Insert lines
   while(getline(infile,currentLine)){
 	parseLoadLine(currentLine, currentKey, currentValue);	//Parse line
 	record.append(currentKey, currentValue, recordId);
 	if(index)
-		if(btindex.insert(currentKey, recordId))//Attempt to insert key
+		if(btindex.bulkInsert(currentKey, recordId))//Attempt to insert key
 			cout << "Could not insert key into index.\n";
+	if(index) // the table keeps at most MAX_VALUE_LENGTH-1 bytes of the value
+		if(vindex.bulkInsert(currentValue.substr(0, RecordFile::MAX_VALUE_LENGTH-1), recordId))
+			cout << "Could not insert value into index.\n";
   }
   
   //Close record file
   record.close();
-  if(index) //Close BTIndex if opened
+  if(index) { //Build and close BTIndex if opened
+	if(btindex.endBulkLoad())
+		cout << "Could not build the index.\n";
+	if(vindex.endBulkLoad())
+		cout << "Could not build the value index.\n";
 	btindex.close();
+	vindex.close();
+  }
   
   return 0;
 }
 
+RC SqlEngine::openIndex(const string& table, char mode, BTreeIndex& btindex)
+{
+  RC rc;
+
+  if ((rc = btindex.open(table + ".idx", mode)) != RC_INVALID_FILE_FORMAT) return rc;
+
+  fprintf(stderr, "Rebuilding the indexes of table %s, which are in an old format\n", table.c_str());
+  if ((rc = rebuildIndexes(table)) < 0) {
+    fprintf(stderr, "Error: could not rebuild the indexes of table %s\n", table.c_str());
+    return rc;
+  }
+  return btindex.open(table + ".idx", mode);
+}
+
+RC SqlEngine::rebuildIndexes(const string& table)
+{
+  RecordFile rf;
+  RecordId   rid;
+  BTreeIndex btindex;
+  BTreeStringIndex vindex;
+  RC     rc;
+  int    key;
+  string value;
+
+  if ((rc = rf.open(table + ".tbl", 'r')) < 0) return rc;
+
+  // the old files go, and the new indexes are bulk loaded like LOAD does
+  remove((table + ".idx").c_str());
+  remove((table + ".vidx").c_str());
+  if ((rc = btindex.open(table + ".idx", 'w')) < 0 || (rc = vindex.open(table + ".vidx", 'w')) < 0) {
+    rf.close();
+    return rc;
+  }
+  btindex.beginBulkLoad(fillFactor);
+  vindex.beginBulkLoad(fillFactor);
+
+  rf.setSequential(true);
+  for (rid.pid = rid.sid = 0; rid < rf.endRid(); rf.next(rid)) {
+    if ((rc = rf.read(rid, key, value)) < 0 ||
+        (rc = btindex.bulkInsert(key, rid)) < 0 ||
+        (rc = vindex.bulkInsert(value, rid)) < 0) break;
+  }
+
+  if (rc >= 0) rc = btindex.endBulkLoad();
+  if (rc >= 0) rc = vindex.endBulkLoad();
+  btindex.close();
+  vindex.close();
+  rf.close();
+
+  // a half-built index would be taken for a good one
+  if (rc < 0) {
+    remove((table + ".idx").c_str());
+    remove((table + ".vidx").c_str());
+  }
+  return rc;
+}
+
+RC SqlEngine::setFillFactor(double fill)
+{
+  if (!(fill > 0 && fill <= 1)) return RC_INVALID_FILL_FACTOR;
+  fillFactor = fill;
+  return 0;
+}
+
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
 {
     const char *s;
@@ -13,6 +13,7 @@
 #include <vector>
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "BTreeIndex.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
@@ -50,6 +51,18 @@ class SqlEngine {
    */
   static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds);
 
+  /**
+   * executes a SELECT statement whose conditions are ORed together.
+   * a list of key = conditions is answered from the key index, which
+   * finds all the keys in one walk down the tree.
+   * @param attr[IN] attribute in the SELECT clause
+   * (1: key, 2: value, 3: *, 4: count(*))
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error
+   */
+  static RC selectAny(int attr, const std::string& table, const std::vector<SelCond>& conds);
+
   /**
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
@@ -67,6 +80,42 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * make select() open table and index files memory-mapped ('m' mode)
+   * instead of reading them through the buffer pool.
+   * @param on[IN] true to memory-map the files
+   */
+  static void setMapReads(bool on) { mapReads = on; }
+
+  /**
+   * set how full load() packs the nodes of the indexes it builds.
+   * @param fill[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error
+   */
+  static RC setFillFactor(double fill);
+
+ private:
+  /**
+   * open the key index of a table. an index file that BTreeIndex
+   * cannot read, such as one written before indexes had a header page,
+   * is rebuilt from the table first, together with the value index.
+   * @param table[IN] the table name
+   * @param mode[IN] the mode to open the index in
+   * @param btindex[OUT] the index to open
+   * @return error code. 0 if no error
+   */
+  static RC openIndex(const std::string& table, char mode, BTreeIndex& btindex);
+
+  /**
+   * build the key and value indexes of a table anew from its tuples.
+   * @param table[IN] the table name
+   * @return error code. 0 if no error
+   */
+  static RC rebuildIndexes(const std::string& table);
+
+  static bool mapReads;  // true if select() opens files in 'm' mode
+  static double fillFactor;  // the fill factor of indexes built by load()
 };
 
 #endif /* SQLENGINE_H */
@@ -12,19 +12,26 @@ int  sqllex(void);
 void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
 extern "C" { int  sqlwrap() { return 1; } }
 
-static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds)
+static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds, bool any = false)
 {
   struct tms tmsbuf;
   clock_t btime, etime;
   int     bpagecnt, epagecnt;
+  int     bhitcnt, ehitcnt;
+  int     bprefetchcnt, eprefetchcnt;
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
-  SqlEngine::select(attr, table, conds);
+  bhitcnt = PageFile::getCacheHitCount();
+  bprefetchcnt = PageFile::getPagePrefetchCount();
+  if (any) SqlEngine::selectAny(attr, table, conds);
+  else SqlEngine::select(attr, table, conds);
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
+  ehitcnt = PageFile::getCacheHitCount();
+  eprefetchcnt = PageFile::getPagePrefetchCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages (%d cache hits, %d prefetched with depth %d)\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt, ehitcnt - bhitcnt, eprefetchcnt - bprefetchcnt, PageFile::getReadAhead());
 }
 
 %}
@@ -44,7 +51,7 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 %type <integer> attributes attribute comparator
 %type <string> table value
 %type <cond> condition
-%type <conds> conditions
+%type <conds> conditions alternatives
 %%
 
 commands:
@@ -91,6 +98,14 @@ select_command:
 		}
 	  	delete $6;
 	}
+	| SELECT attributes FROM table WHERE alternatives LF {
+	        runSelect($2, $4, *$6, true);
+	  	free($4);
+	  	for (unsigned i = 0; i < $6->size(); i++) {
+		    free((*$6)[i].value);
+		}
+	  	delete $6;
+	}
 	;
 
 conditions:
@@ -107,6 +122,22 @@ conditions:
 	}
 	;
 
+alternatives:
+	condition OR condition {
+	  std::vector<SelCond>* v = new std::vector<SelCond>;
+	  v->push_back(*$1);
+	  v->push_back(*$3);
+	  $$ = v;
+          delete $1;
+          delete $3;
+	}
+	| alternatives OR condition {
+	  $1->push_back(*$3);
+	  $$ = $1;
+          delete $3;
+	}
+	;
+
 condition:
 	attribute comparator value { 
 	  SelCond* c = new SelCond;
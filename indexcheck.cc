@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Consistency check of the backward links between B+tree leaves.
+ * For each leaf format and page size it builds an index by inserting
+ * keys one at a time, by bulk loading them, and by bulk loading half of
+ * them and inserting the rest, with some keys repeated. It then checks
+ * that every leaf points back to the leaf before it, and that
+ * readBackward() returns the entries readForward() does, in reverse,
+ * from any upper bound. Run it with "make check".
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "BTreeIndex.h"
+#include "BTreeNode.h"
+
+using std::vector;
+
+static const char* INDEX_FILE = "indexcheck.idx";
+static const int KEYS = 20000;
+
+// build the index from pairs: 0 inserts them, 1 bulk loads them, and
+// 2 bulk loads the first half and inserts the rest
+static RC build(int mode, const vector<int>& key)
+{
+  RC rc;
+  BTreeIndex index;
+
+  unlink(INDEX_FILE);
+  if ((rc = index.open(INDEX_FILE, 'w')) < 0) return rc;
+  int bulk = (mode == 0) ? 0 : (mode == 1) ? key.size() : key.size() / 2;
+  if (bulk > 0) {
+    index.beginBulkLoad(1.0);
+    for (int i = 0; i < bulk; i++) {
+      RecordId rid = { i, 0 };
+      if ((rc = index.bulkInsert(key[i], rid)) < 0) return rc;
+    }
+    if ((rc = index.endBulkLoad()) < 0) return rc;
+  }
+  for (int i = bulk; i < (int) key.size(); i++) {
+    RecordId rid = { i, 0 };
+    if ((rc = index.insert(key[i], rid)) < 0) return rc;
+  }
+  return index.close();
+}
+
+// check the index file, returning the # problems found
+static int check(int keyCount)
+{
+  BTreeIndex index;
+  IndexCursor cursor;
+  int key, problems = 0;
+  RecordId rid;
+
+  if (index.open(INDEX_FILE, 'r') < 0 || index.locate(INT_MIN, cursor) < 0) return 1;
+  PageId first = cursor.pid;
+
+  // every entry in key order
+  vector<int> forward;
+  while (index.readForward(cursor, key, rid) == 0) forward.push_back(key);
+  if ((int) forward.size() != keyCount) problems++;
+
+  // the same entries backward from a few upper bounds
+  int bounds[] = { INT_MAX, KEYS / 3, 0, -1 };
+  for (unsigned b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++) {
+    vector<int> backward;
+    if (index.locateBackward(bounds[b], cursor) < 0) return problems + 1;
+    while (index.readBackward(cursor, key, rid) == 0) backward.push_back(key);
+    std::reverse(backward.begin(), backward.end());
+    int expected = std::upper_bound(forward.begin(), forward.end(), bounds[b]) - forward.begin();
+    if (backward != vector<int>(forward.begin(), forward.begin() + expected)) problems++;
+  }
+  index.close();
+
+  // every leaf points back to the one before it
+  PageFile pf;
+  PageId prev = RC_END_OF_TREE;
+  if (pf.open(INDEX_FILE, 'r') < 0) return problems + 1;
+  BTLeafNode leaf(pf.pageSize());
+  for (PageId pid = first; pid != RC_END_OF_TREE; pid = leaf.getNextNodePtr()) {
+    if (leaf.read(pid, pf) < 0) return problems + 1;
+    if (leaf.getPrevNodePtr() != prev) problems++;
+    prev = pid;
+  }
+  pf.close();
+
+  return problems;
+}
+
+int main()
+{
+  int sizes[] = { 512, 1024, 4096 };
+  const char* modes[] = { "insert", "bulk", "bulk+insert" };
+  int failures = 0;
+
+  // keys in random order, every tenth one repeated a few times
+  vector<int> key;
+  srand(143);
+  for (int i = 0; i < KEYS; i++) {
+    int k = rand() % KEYS;
+    for (int j = (k % 10 == 0) ? 1 + k % 7 : 1; j > 0; j--) key.push_back(k);
+  }
+  std::random_shuffle(key.begin(), key.end());
+
+  for (int packed = 0; packed <= 1; packed++) {
+    BTreeIndex::setPackedLeaves(packed);
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      PageFile::setDefaultPageSize(sizes[s]);
+      for (int mode = 0; mode < 3; mode++) {
+        int problems = (build(mode, key) < 0) ? 1 : check(key.size());
+        printf("%-4s %-6s %5d %-11s\n", problems ? "FAIL" : "ok",
+               packed ? "packed" : "plain", sizes[s], modes[mode]);
+        if (problems) failures++;
+      }
+    }
+  }
+
+  unlink(INDEX_FILE);
+  return failures ? 1 : 0;
+}
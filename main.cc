@@ -7,11 +7,82 @@
  * @date 3/24/2008
  */
  
+#include <cstdlib>
+#include <strings.h>
 #include "Bruinbase.h"
+#include "PageFile.h"
 #include "SqlEngine.h"
+#include "BTreeIndex.h"
 
 int main()
 {
+  // size the buffer pool before any file is opened.
+  // BRUINBASE_CACHE_PAGES sets the # of page frames shared by all files.
+  const char* pages = getenv("BRUINBASE_CACHE_PAGES");
+  if (pages != NULL && PageFile::setCacheSize(atoi(pages)) < 0) {
+    fprintf(stderr, "Error: invalid BRUINBASE_CACHE_PAGES value %s\n", pages);
+  }
+
+  // BRUINBASE_WRITE_BACK=0 makes every page write go straight to disk.
+  const char* writeBack = getenv("BRUINBASE_WRITE_BACK");
+  if (writeBack != NULL) PageFile::setWriteBack(atoi(writeBack) != 0);
+
+  // BRUINBASE_CACHE_POLICY=2q picks the scan-resistant 2Q replacement policy.
+  const char* policy = getenv("BRUINBASE_CACHE_POLICY");
+  if (policy != NULL) {
+    if (strcasecmp(policy, "2q") == 0) PageFile::setCachePolicy(PageFile::TWO_Q);
+    else if (strcasecmp(policy, "lru") == 0) PageFile::setCachePolicy(PageFile::LRU);
+    else fprintf(stderr, "Error: invalid BRUINBASE_CACHE_POLICY value %s\n", policy);
+  }
+
+  // BRUINBASE_MMAP=1 makes SELECT memory-map the table and index files.
+  const char* mmapReads = getenv("BRUINBASE_MMAP");
+  if (mmapReads != NULL) SqlEngine::setMapReads(atoi(mmapReads) != 0);
+
+  // BRUINBASE_READAHEAD sets the # of pages prefetched ahead of a scan.
+  const char* readAhead = getenv("BRUINBASE_READAHEAD");
+  if (readAhead != NULL && PageFile::setReadAhead(atoi(readAhead)) < 0) {
+    fprintf(stderr, "Error: invalid BRUINBASE_READAHEAD value %s\n", readAhead);
+  }
+
+  // BRUINBASE_IO=uring starts asynchronous page reads through io_uring.
+  const char* io = getenv("BRUINBASE_IO");
+  if (io != NULL) {
+    if (strcasecmp(io, "uring") == 0) {
+      if (PageFile::setIoBackend(PageFile::IO_URING) < 0) {
+        fprintf(stderr, "Error: io_uring is not available, using blocking I/O\n");
+      }
+    } else if (strcasecmp(io, "sync") != 0) {
+      fprintf(stderr, "Error: invalid BRUINBASE_IO value %s\n", io);
+    }
+  }
+
+  // BRUINBASE_PAGE_SIZE sets the page size of newly created tables and indexes.
+  const char* pageSize = getenv("BRUINBASE_PAGE_SIZE");
+  if (pageSize != NULL && PageFile::setDefaultPageSize(atoi(pageSize)) < 0) {
+    fprintf(stderr, "Error: invalid BRUINBASE_PAGE_SIZE value %s\n", pageSize);
+  }
+
+  // BRUINBASE_PACKED_LEAVES=1 makes new indexes pack their leaves.
+  const char* packed = getenv("BRUINBASE_PACKED_LEAVES");
+  if (packed != NULL) BTreeIndex::setPackedLeaves(atoi(packed) != 0);
+
+  // BRUINBASE_COUNTED_INDEX=1 makes new indexes count the entries under each node.
+  const char* counted = getenv("BRUINBASE_COUNTED_INDEX");
+  if (counted != NULL) BTreeIndex::setCountedNodes(atoi(counted) != 0);
+
+  // BRUINBASE_INDEX_CACHE sets the # of upper B+tree nodes each open index keeps in memory.
+  const char* upper = getenv("BRUINBASE_INDEX_CACHE");
+  if (upper != NULL && BTreeIndex::setUpperCacheSize(atoi(upper)) < 0) {
+    fprintf(stderr, "Error: invalid BRUINBASE_INDEX_CACHE value %s\n", upper);
+  }
+
+  // BRUINBASE_FILL_FACTOR sets how full LOAD ... WITH INDEX packs the index nodes.
+  const char* fill = getenv("BRUINBASE_FILL_FACTOR");
+  if (fill != NULL && SqlEngine::setFillFactor(atof(fill)) < 0) {
+    fprintf(stderr, "Error: invalid BRUINBASE_FILL_FACTOR value %s\n", fill);
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Microbenchmark of the search for a key inside a B+tree node.
+ * For each page size it fills a leaf and a nonleaf node and times
+ * BTLeafNode::locate() and BTNonLeafNode::locateChildPtr() on random
+ * keys, next to a linear walk over the same keys, which is how the
+ * nodes were searched before. Run it with "make bench", and with
+ * "make bench CXXFLAGS=-mavx2" for the AVX2 kernel.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include "BTreeNode.h"
+
+using std::vector;
+
+static const int LOOKUPS = 2000000;
+
+// the time in nanoseconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the position of the first key >= searchKey, found by a linear walk
+static int linearSearch(const vector<int>& key, int searchKey)
+{
+  int eid = 0;
+  while (eid < (int) key.size() && key[eid] < searchKey) eid++;
+  return eid;
+}
+
+int main()
+{
+  int sizes[] = { 1024, 4096, 16384, 65536 };
+  vector<int> probes(LOOKUPS);
+  long long sum = 0;  // keeps the searches from being optimized away
+
+#ifdef __AVX2__
+  printf("kernel: AVX2\n");
+#else
+  printf("kernel: branchless binary search\n");
+#endif
+  printf("%8s %8s %12s %12s %12s\n",
+         "page", "fanout", "leaf ns", "nonleaf ns", "linear ns");
+
+  for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int size = sizes[s];
+    BTLeafNode leaf(size);
+    BTNonLeafNode nonleaf(size);
+
+    // fill both nodes with the even keys 0, 2, 4, ...
+    vector<int> key;
+    for (int i = 0; i < leaf.getMaxKeyCount(); i++) {
+      RecordId rid = { i, 0 };
+      leaf.insert(2 * i, rid);
+      key.push_back(2 * i);
+    }
+    nonleaf.initializeRoot(0, 0, 1);
+    for (int i = 1; i < nonleaf.getMaxKeyCount(); i++) nonleaf.insert(2 * i, i + 1);
+
+    // probe hits and misses all over the node
+    srand(size);
+    for (int i = 0; i < LOOKUPS; i++) probes[i] = rand() % (2 * leaf.getMaxKeyCount() + 1);
+
+    double start = now();
+    for (int i = 0; i < LOOKUPS; i++) {
+      int eid;
+      leaf.locate(probes[i], eid);
+      sum += eid;
+    }
+    double leafTime = (now() - start) / LOOKUPS;
+
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++) {
+      PageId pid;
+      nonleaf.locateChildPtr(probes[i], pid);
+      sum += pid;
+    }
+    double nonleafTime = (now() - start) / LOOKUPS;
+
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++) sum += linearSearch(key, probes[i]);
+    double linearTime = (now() - start) / LOOKUPS;
+
+    printf("%8d %8d %12.1f %12.1f %12.1f\n",
+           size, leaf.getMaxKeyCount(), leafTime, nonleafTime, linearTime);
+  }
+
+  fprintf(stderr, "(checksum %lld)\n", sum);
+  return 0;
+}
@@ -1,7 +1,8 @@
 #!/bin/sh
 
-rm -f xsmall.tbl xsmall.idx
-rm -f small.tbl small.idx
-rm -f medium.tbl medium.idx
-rm -f large.tbl large.idx
-rm -f xlarge.tbl xlarge.idx
+rm -f xsmall.tbl xsmall.idx xsmall.vidx
+rm -f small.tbl small.idx small.vidx
+rm -f medium.tbl medium.idx medium.vidx
+rm -f large.tbl large.idx large.vidx
+rm -f xlarge.tbl xlarge.idx xlarge.vidx
+rm -f reload.tbl reload.idx reload.vidx
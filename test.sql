@@ -20,3 +20,13 @@ SELECT COUNT(*) FROM xlarge
 SELECT * FROM xlarge WHERE key = 4240
 SELECT * FROM xlarge WHERE key > 400 AND key < 500 AND key > 100 AND key < 4000000
 
+
+LOAD reload FROM 'large.del' WITH INDEX
+LOAD reload FROM 'xlarge.del' WITH INDEX
+LOAD reload FROM 'xlarge.del' WITH INDEX
+SELECT COUNT(*) FROM reload
+SELECT * FROM reload WHERE key = 4240
+SELECT * FROM reload WHERE key > 400 AND key < 500
+SELECT * FROM reload WHERE key = 4240 OR key = 489 OR key = 5
+SELECT COUNT(*) FROM reload WHERE key = 4240 OR key = 272 OR key = 272
+SELECT * FROM large WHERE key = 272 OR value = 'Blue Hawaii'